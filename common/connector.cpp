@@ -0,0 +1,264 @@
+/**
+  * File:    connector.cpp
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: IPK projects - connecting to servers shared by ftpclient
+  *          (project 1) and client (project 2).
+  *          Addresses are raced in the style of Happy Eyeballs (RFC 8305)
+  *          and resolved addresses are cached in the process.
+  */
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "connector.h"
+
+using namespace std;
+
+/** Resolved address */
+typedef struct address {
+  struct sockaddr_storage addr;
+  socklen_t length;
+  int family;
+} TAddress;
+
+/** Cached result of name resolution */
+typedef struct cached {
+  vector<TAddress> addresses;
+  long long expires; // ms, monotonic
+} TCached;
+
+static map<string, TCached> cache; // host:port:family -> addresses
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Returns monotonic time in milliseconds */
+static long long nowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/** Checks whether host is an IPv4 or IPv6 address literal */
+static bool isNumeric(const string &host) {
+  unsigned char buffer[sizeof(struct in6_addr)];
+  return inet_pton(AF_INET, host.c_str(), buffer) == 1 ||
+         inet_pton(AF_INET6, host.c_str(), buffer) == 1;
+}
+
+/**
+ * Resolves host and port, results for host names are cached for RESOLVE_TTL
+ * seconds. Addresses of different families are interleaved (RFC 8305, 4).
+ * @return Returns false if the host could not be resolved
+ */
+static bool resolve(const string &key, const string &host, const string &port,
+                    int family, vector<TAddress> *addresses) {
+  bool numeric = isNumeric(host);
+  if (!numeric) {
+    pthread_mutex_lock(&cacheLock);
+    map<string, TCached>::iterator found = cache.find(key);
+    bool hit = found != cache.end() && found->second.expires > nowMs();
+    if (hit)
+      *addresses = found->second.addresses;
+    pthread_mutex_unlock(&cacheLock);
+    if (hit)
+      return true;
+  }
+
+  struct addrinfo setting;
+  struct addrinfo *list;
+  struct addrinfo *ptr;
+  memset(&setting, 0, sizeof setting); // make the struct empty
+  setting.ai_family = family;
+  setting.ai_socktype = SOCK_STREAM;
+  setting.ai_flags = numeric ? AI_NUMERICHOST : 0;
+  if (getaddrinfo(host.c_str(), port.c_str(), &setting, &list) != 0)
+    return false;
+
+  vector<TAddress> inet6;
+  vector<TAddress> inet;
+  for (ptr = list; ptr != NULL; ptr = ptr->ai_next) {
+    TAddress address;
+    if (ptr->ai_addrlen > sizeof address.addr)
+      continue;
+    memcpy(&address.addr, ptr->ai_addr, ptr->ai_addrlen);
+    address.length = ptr->ai_addrlen;
+    address.family = ptr->ai_family;
+    (ptr->ai_family == AF_INET6 ? inet6 : inet).push_back(address);
+  }
+  freeaddrinfo(list);
+
+  addresses->clear();
+  for (size_t i = 0; i < inet6.size() || i < inet.size(); i++) {
+    if (i < inet6.size())
+      addresses->push_back(inet6[i]);
+    if (i < inet.size())
+      addresses->push_back(inet[i]);
+  }
+  if (addresses->empty())
+    return false;
+
+  if (!numeric) {
+    pthread_mutex_lock(&cacheLock);
+    cache[key].addresses = *addresses;
+    cache[key].expires = nowMs() + RESOLVE_TTL * 1000;
+    pthread_mutex_unlock(&cacheLock);
+  }
+  return true;
+}
+
+/** Moves the address that connected first to the front of the cached list */
+static void promote(const string &key, const TAddress &winner) {
+  pthread_mutex_lock(&cacheLock);
+  map<string, TCached>::iterator found = cache.find(key);
+  if (found != cache.end()) {
+    vector<TAddress> &addresses = found->second.addresses;
+    for (size_t i = 1; i < addresses.size(); i++) {
+      if (addresses[i].length == winner.length &&
+          memcmp(&addresses[i].addr, &winner.addr, winner.length) == 0) {
+        addresses.erase(addresses.begin() + i);
+        addresses.insert(addresses.begin(), winner);
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&cacheLock);
+}
+
+/** Starts non-blocking connect, returns descriptor or -1 on immediate failure */
+static int startConnect(const TAddress &address, bool *connected) {
+  int fd;
+  if ((fd = socket(address.family, SOCK_STREAM, 0)) == -1)
+    return -1;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  *connected = false;
+  if (connect(fd, (const struct sockaddr *)&address.addr, address.length) == 0) {
+    *connected = true;
+  } else if (errno != EINPROGRESS) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * Connects to host and port. Addresses are tried one after another, but
+ * the next one is started after CONNECT_DELAY ms (or as soon as the previous
+ * attempt fails) without cancelling the previous attempts. The first attempt
+ * to connect wins, so a single unreachable address costs only CONNECT_DELAY.
+ * @param host Host name or address
+ * @param port Port number or service name
+ * @param family AF_INET, AF_INET6 or AF_UNSPEC
+ * @param timeout Time limit for the whole attempt in ms
+ * @param fd Descriptor of connected (blocking) socket is returned here
+ * @param resolved If not NULL, monotonic time in ns when the name
+ *        was resolved is returned here
+ * @return Returns CONNECT_OK or an error value
+ */
+int raceConnect(const string &host, const string &port, int family, int timeout, int *fd,
+                long long *resolved) {
+  string key = host + ":" + port + ":" + (family == AF_INET ? "4" : family == AF_INET6 ? "6" : "*");
+  vector<TAddress> addresses;
+  if (!resolve(key, host, port, family, &addresses))
+    return CONNECT_EHOST;
+  if (resolved != NULL) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *resolved = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  }
+
+  vector<struct pollfd> attempts;
+  vector<size_t> attempted; // index of address for each attempt
+  size_t next = 0;
+  long long deadline = nowMs() + timeout;
+  long long nextStart = 0;
+  int winner = -1;
+  size_t winnerIndex = 0;
+
+  while (winner == -1) {
+    long long now = nowMs();
+    if (now >= deadline)
+      break;
+
+    if (next < addresses.size() && now >= nextStart) { // start next attempt
+      bool connected;
+      int attempt = startConnect(addresses[next], &connected);
+      if (attempt != -1 && connected) {
+        winner = attempt;
+        winnerIndex = next;
+        break;
+      }
+      if (attempt != -1) {
+        struct pollfd pfd;
+        pfd.fd = attempt;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        attempts.push_back(pfd);
+        attempted.push_back(next);
+        nextStart = now + CONNECT_DELAY;
+      } else {
+        nextStart = 0; // failed at once, try the next address
+      }
+      next++;
+      continue;
+    }
+
+    if (attempts.empty()) { // everything failed
+      if (next >= addresses.size())
+        break;
+      nextStart = 0;
+      continue;
+    }
+
+    long long wait = deadline - now;
+    if (next < addresses.size() && nextStart - now < wait)
+      wait = nextStart - now;
+    int ready = poll(&attempts[0], attempts.size(), wait);
+    if (ready == -1 && errno != EINTR)
+      break;
+
+    for (size_t i = 0; ready > 0 && i < attempts.size(); ) {
+      if (attempts[i].revents == 0) {
+        i++;
+        continue;
+      }
+      int error = 0;
+      socklen_t length = sizeof error;
+      if (getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0) {
+        winner = attempts[i].fd;
+        winnerIndex = attempted[i];
+        attempts.erase(attempts.begin() + i);
+        attempted.erase(attempted.begin() + i);
+        break;
+      }
+      close(attempts[i].fd); // failed, try the next address at once
+      attempts.erase(attempts.begin() + i);
+      attempted.erase(attempted.begin() + i);
+      nextStart = 0;
+    }
+  }
+
+  for (size_t i = 0; i < attempts.size(); i++)
+    close(attempts[i].fd);
+
+  if (winner == -1)
+    return nowMs() >= deadline ? CONNECT_ETIMEOUT : CONNECT_EFAILED;
+
+  fcntl(winner, F_SETFL, fcntl(winner, F_GETFL) & ~O_NONBLOCK);
+  if (winnerIndex > 0 && !isNumeric(host))
+    promote(key, addresses[winnerIndex]);
+  *fd = winner;
+  return CONNECT_OK;
+}
@@ -0,0 +1,31 @@
+/**
+  * File:    connector.h
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: IPK projects - connecting to servers shared by ftpclient
+  *          (project 1) and client (project 2).
+  *          Addresses are raced in the style of Happy Eyeballs (RFC 8305)
+  *          and resolved addresses are cached in the process.
+  */
+
+#ifndef CONNECTOR_H
+#define CONNECTOR_H
+
+#include <string>
+#include <cstddef>
+
+#define CONNECT_TIMEOUT 10000 // ms for the whole connection attempt
+#define CONNECT_DELAY 250 // ms before the next address is tried
+#define RESOLVE_TTL 60 // s for which resolved addresses are reused
+
+/** Results of raceConnect() */
+enum {
+  CONNECT_OK = 0,
+  CONNECT_EHOST, // host could not be resolved
+  CONNECT_EFAILED, // all addresses refused or failed
+  CONNECT_ETIMEOUT // no address connected in time
+};
+
+int raceConnect(const std::string &host, const std::string &port, int family,
+                int timeout, int *fd, long long *resolved = NULL);
+
+#endif
@@ -0,0 +1,221 @@
+/**
+  * File:    ftpbench.cpp
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Simple FTP client for IPP (project 1)
+  *          Benchmark of the FTP session against an in-process ftpstub:
+  *          login time, command round trip with fragmented replies,
+  *          listing latency, large-listing throughput and parser cost.
+  *          Usage: ftpbench [rounds]
+  */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <signal.h>
+
+#include "session.h"
+#include "listing.h"
+#include "stub.h"
+
+#define LARGELISTING 100000 // entries of the large listing
+
+using namespace std;
+
+/** Durations of repeated measurements */
+class Samples {
+  public:
+    void add(long long ns) { values.push_back(ns); }
+    void print(const string &name);
+  private:
+    vector<long long> values;
+};
+
+/** Prints min, median and mean in microseconds */
+void Samples::print(const string &name) {
+  if (values.empty()) {
+    cout << name << ": failed" << endl;
+    return;
+  }
+  sort(values.begin(), values.end());
+  long long sum = 0;
+  for (size_t i = 0; i < values.size(); i++)
+    sum += values[i];
+  cout << name << ": " << values.size() << " rounds, min " << values[0] / 1000
+       << " us, median " << values[values.size() / 2] / 1000
+       << " us, mean " << sum / (long long)values.size() / 1000 << " us" << endl;
+}
+
+/** Returns url of the stub listening on given port */
+TUrl stubUrl(int port) {
+  TUrl url;
+  ostringstream convert;
+  convert << port;
+  url.user = "anonymous";
+  url.password = "ftpbench";
+  url.host = "127.0.0.1";
+  url.port = convert.str();
+  url.path = "";
+  url.auth = false;
+  return url;
+}
+
+/** Measures connecting and logging in */
+void benchLogin(const string &name, const TStubConfig &config, int rounds) {
+  FtpStub stub(config);
+  Samples samples;
+  TUrl url = stubUrl(stub.start());
+
+  for (int i = 0; i < rounds; i++) {
+    FtpSession session;
+    long long start = monotonicNs();
+    if (session.open(url) != EOK)
+      break;
+    samples.add(monotonicNs() - start);
+    session.quit();
+  }
+  samples.print(name);
+}
+
+/** Measures round trip of a command, i.e. cost of reading its reply */
+void benchCommand(const string &name, const TStubConfig &config, int rounds) {
+  FtpStub stub(config);
+  FtpSession session;
+  Samples samples;
+  TReply reply;
+
+  if (session.open(stubUrl(stub.start())) == EOK) {
+    for (int i = 0; i < rounds; i++) {
+      long long start = monotonicNs();
+      if (session.command("FEAT", &reply) != EOK || reply.code != 211)
+        break;
+      samples.add(monotonicNs() - start);
+    }
+    session.quit();
+  }
+  samples.print(name);
+}
+
+/** Measures the time of getting a listing */
+void benchListing(const string &name, const TStubConfig &config, const string &order, int rounds) {
+  FtpStub stub(config);
+  FtpSession session;
+  Samples samples;
+  string text;
+
+  if (session.open(stubUrl(stub.start())) == EOK) {
+    session.setType('A');
+    for (int i = 0; i < rounds; i++) {
+      long long start = monotonicNs();
+      if (session.transfer(order + " /", &text) != EOK)
+        break;
+      samples.add(monotonicNs() - start);
+    }
+    session.quit();
+  }
+  samples.print(name);
+}
+
+/**
+ * Measures throughput of a large listing, with and without parsing
+ * @param text The last received listing is returned here
+ */
+void benchLargeListing(const string &name, const string &order, int rounds, string *text) {
+  TStubConfig config;
+  stubDefaults(&config);
+  config.depth = 0;
+  config.files = LARGELISTING;
+  FtpStub stub(config);
+  FtpSession session;
+  long long received = 0;
+  long long parsed = 0;
+  size_t entries = 0;
+
+  if (session.open(stubUrl(stub.start())) == EOK) {
+    session.setType('A');
+    for (int i = 0; i < rounds; i++) {
+      TListing listing;
+      long long start = monotonicNs();
+      if (session.transfer(order + " /", &listing.text) != EOK)
+        break;
+      long long middle = monotonicNs();
+      listing.mlsd = order == "MLSD";
+      parseListing(&listing);
+      long long end = monotonicNs();
+      received += middle - start;
+      parsed += end - start;
+      entries += listing.entries.size();
+      *text = listing.text;
+    }
+    session.quit();
+  }
+
+  if (received == 0) {
+    cout << name << ": failed" << endl;
+    return;
+  }
+  double megabytes = (double)text->length() * rounds / 1E6;
+  cout << name << ": " << megabytes / (received / 1E9) << " MB/s received, "
+       << entries / (parsed / 1E9) << " entries/s received and parsed" << endl;
+}
+
+/** Measures cost of parsing a listing */
+void benchParser(const string &name, const string &text, bool mlsd, int rounds) {
+  TListing listing;
+  listing.text = text;
+  listing.mlsd = mlsd;
+  size_t entries = 0;
+
+  long long start = monotonicNs();
+  for (int i = 0; i < rounds; i++) {
+    parseListing(&listing);
+    entries += listing.entries.size();
+  }
+  long long elapsed = monotonicNs() - start;
+  cout << name << ": " << (entries ? elapsed / (long long)entries : 0) << " ns/entry, "
+       << (double)text.length() * rounds / 1E6 / (elapsed / 1E9) << " MB/s" << endl;
+}
+
+//////// MAIN PROGRAM ////////
+int main(int argc, char *argv[]) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 200;
+  if (rounds < 1)
+    rounds = 1;
+  signal(SIGPIPE, SIG_IGN);
+
+  TStubConfig config;
+  stubDefaults(&config);
+  benchLogin("login", config, rounds);
+  config.fragment = 1;
+  benchLogin("login, 1 byte segments", config, rounds);
+  config.fragment = 0;
+  config.latency = 1;
+  benchLogin("login, 1 ms reply latency", config, rounds);
+  config.latency = 0;
+
+  benchCommand("FEAT", config, rounds);
+  config.fragment = 16;
+  benchCommand("FEAT, 16 byte segments", config, rounds);
+  config.fragment = 1;
+  benchCommand("FEAT, 1 byte segments", config, rounds);
+  config.fragment = 0;
+
+  benchListing("MLSD of 20 entries", config, "MLSD", rounds);
+  benchListing("LIST of 20 entries", config, "LIST", rounds);
+  config.latency = 1;
+  benchListing("MLSD of 20 entries, 1 ms reply latency", config, "MLSD", rounds);
+  config.latency = 0;
+
+  string mlsd;
+  string list;
+  int largeRounds = max(rounds / 40, 1);
+  benchLargeListing("MLSD of 100000 entries", "MLSD", largeRounds, &mlsd);
+  benchLargeListing("LIST of 100000 entries", "LIST", largeRounds, &list);
+
+  benchParser("MLSD parser", mlsd, true, largeRounds);
+  benchParser("LIST parser", list, false, largeRounds);
+
+  return EXIT_SUCCESS;
+}
@@ -10,35 +10,25 @@
 #include <string>
 #include <cstring>
 #include <unistd.h>
-#include <netdb.h>
-#include <arpa/inet.h>
-#include <netinet/in.h>
 #include <fstream>
 #include <cstdlib>
+#include <fcntl.h>
 #include <sys/types.h>
-#include <sys/socket.h>
+#include <sys/stat.h>
 #include <cerrno>
+#include <deque>
+#include <vector>
+#include <iomanip>
+#include <pthread.h>
 
+#include "session.h"
+#include "listing.h"
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
-#define BUFFSIZE 1000
+#define MAXJOBS 64 // maximum number of parallel sessions
 
 using namespace std;
 
-/** Error values */
-enum {
-  EOK = 0, // No error detected
-  EPARAMNUM, // Wrong number of parameters 
-  EPARAM, // Wrong parameter
-  EPASV, // PASV
-  ERECV, // RECV 
-  ESEND, // SEND
-  ECONNECTION,
-  EHOST,
-  ELOGING,
-  EUNKNOWN // Unknown error
-};
-
 /** Error messages */
 const char *ECODEMSG[] = {
   "Everything is OK.",
@@ -50,18 +40,27 @@ const char *ECODEMSG[] = {
   "Failed to connect to server",
   "Host is not available",
   "Not logged in",
+  "Server failed to transfer the data",
+  "Failed to write the output",
+  "Local file could not be opened",
+  "Server does not support restart of transfer",
+  "Server refused transfer mode or type",
   "Unknown error"
 };
 
-/** Structure for url address */
-typedef struct url {
-  string user;
-  string password;
-  string host;
-  string port;
-  string path;
-  bool auth;
-} TUrl;
+/** Structure for program options */
+typedef struct options {
+  bool get; // download file instead of listing
+  bool resume; // continue partially downloaded file
+  bool recursive; // walk the directory tree
+  int jobs; // number of parallel sessions for recursive walk
+  string batch; // file with commands to run in one session, "-" - stdin
+  bool mlsd; // list with MLSD instead of LIST
+  bool json; // print listings as JSON lines
+  string cache; // directory for cached listings, empty - no cache
+  string output; // local file for download, "-" - stdout
+                 // local directory for recursive download
+} TOptions;
 
 /**
  * Prints error messages according to given error code and exits;
@@ -83,14 +82,60 @@ void printECode (int eCode) {
  * @param argc Number of program parameters
  * @param argv Parameters
  * @param url Structure for processed parameters of url
+ * @param options Structure for program options
  * @return Returns error value
  */
-int getParams(int argc, char *argv[], TUrl *url) {
+int getParams(int argc, char *argv[], TUrl *url, TOptions *options) {
  
-  if (argc != 2)
+  // [-b file | -r [-j jobs]] [-M] [-J] [-C cachedir] [-g [-c] [-o file]] url
+  if (argc < 2)
     return EPARAMNUM;
+
+  options->get = false;
+  options->resume = false;
+  options->recursive = false;
+  options->jobs = 4;
+  options->output = "";
+  options->batch = "";
+  options->mlsd = false;
+  options->json = false;
+  options->cache = "";
+
+  int i;
+  for (i = 1; i < argc - 1; i++) {
+    if (strcmp(argv[i], "-g") == 0) {
+      options->get = true;
+    } else if (strcmp(argv[i], "-c") == 0) {
+      options->resume = true;
+    } else if (strcmp(argv[i], "-r") == 0) {
+      options->recursive = true;
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc - 1) {
+      options->jobs = atoi(argv[++i]);
+      if (options->jobs < 1 || options->jobs > MAXJOBS)
+        return EPARAM;
+    } else if (strcmp(argv[i], "-M") == 0) {
+      options->mlsd = true;
+    } else if (strcmp(argv[i], "-J") == 0) {
+      options->json = true;
+    } else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc - 1) {
+      options->cache = argv[++i];
+    } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc - 1) {
+      options->batch = argv[++i];
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc - 1) {
+      options->output = argv[++i];
+    } else {
+      return EPARAM;
+    }
+  }
+
+  if ((options->resume || !options->output.empty()) && !options->get)
+    return EPARAM;
+  if (options->resume && options->output == "-") // stdout can't be continued
+    return EPARAM;
+  if (!options->batch.empty() && (options->get || options->recursive))
+    return EPARAM;
   
-  string urlString = argv[1];
+  string urlString = argv[argc - 1];
   url->user = "anonymous";
   url->password = "xborek08@stud.fit.vutbr.cz";
   url->host = "";
@@ -160,265 +205,524 @@ int getParams(int argc, char *argv[], TUrl *url) {
 }
 
 /**
- * @param message Received message is returned in this string
- * @param socketfd Id of socket to read from
- * @return Returns code returned by ftp server
+ * Continues partially downloaded file, data are appended to the local file
+ * @param session Logged in session
+ * @param path Remote file
+ * @param local Existing local file
+ * @param offset Size of the local file
+ * @return Returns error value, EREST if the file has to be downloaded again
  */
-int readSocket(string *message, int socketfd) {
-
-  string code;
-  char buffer[BUFFSIZE];
-  memset(&buffer, 0, sizeof buffer); // make the buffer empty
-  *message = "";
-  if (recv(socketfd, buffer, BUFFSIZE - 1, 0) == -1) {
-    close(socketfd);
-    printECode(ERECV);
+int resumeTo(FtpSession &session, const string &path, const string &local, off_t offset) {
+  int eCode;
+  int fd;
+  if ((fd = open(local.c_str(), O_WRONLY)) == -1)
+    return EFILE;
+
+  TReply reply;
+  if ((eCode = session.command("SIZE " + path, &reply)) != EOK) {
+    close(fd);
+    return eCode;
   }
-
-  *message += buffer;
-
-  string::const_iterator i = message->begin();
-  unsigned j = 0;
-  while (i != message->end() && isdigit(*i) ){
-    i++;
-    j++;
-  }
-
-  if (j !=  3)
-    return ERECV;
-    
-  code = message->substr(0, 3);
-  if (message->substr(3, 1) != " " && message->find("\n" + code + " ") == string::npos) {
-    // some lines are missing
-    while (message->find("\n" + code + " ") == string::npos) {
-
-      if (recv(socketfd, buffer, BUFFSIZE - 1, 0) == -1) {
-        close(socketfd);
-        printECode(ERECV);
-      }
-
-      *message += buffer;
+  if (reply.code == 213) {
+    off_t size = strtoll(reply.text.c_str() + 4, NULL, 10);
+    if (size == offset) { // already complete
+      close(fd);
+      return EOK;
     }
-  }
-   
-  while (message->find("\r\n") == string::npos) {
-    // end of line is missing
-    if (recv(socketfd, buffer, BUFFSIZE - 1, 0) == -1) {
-      close(socketfd);
-      printECode(ERECV);
+    if (size < offset) { // different file
+      close(fd);
+      return EREST;
     }
-    *message += buffer;
   }
-    
-  return atoi(code.c_str());
-}
 
-//////// MAIN PROGRAM ////////
-int main (int argc, char *argv[]) {
-  
-  TUrl url;
-  int eCode = EOK;
-  if ((eCode = getParams(argc, argv, &url)) != EOK)
-    printECode(eCode);
-  
-  int stat;
-  struct addrinfo setting;
-  struct addrinfo *list;
-  struct addrinfo *ptr;
-
-  memset(&setting, 0, sizeof setting); // make the struct empty
-  setting.ai_family = AF_INET;
-  setting.ai_socktype = SOCK_STREAM; 
-  setting.ai_protocol = 0;
-  if ((stat = getaddrinfo(url.host.c_str(), url.port.c_str(), &setting, &list)) != 0) {
-    printECode(EHOST);
+  if (lseek(fd, offset, SEEK_SET) == -1) {
+    close(fd);
+    return EFILE;
   }
+  eCode = session.transfer("RETR " + path, fd, offset);
+  if (close(fd) == -1 && eCode == EOK)
+    eCode = EWRITE;
+  return eCode;
+}
 
-  int socketfd;
+/**
+ * Downloads a file in binary mode, data are written directly to the local
+ * file. Partially downloaded file is continued if requested and possible.
+ * Otherwise data are written to a temporary file next to the local one,
+ * which replaces the local file only when the download succeeds.
+ * @param session Logged in session
+ * @param path Remote file
+ * @param local Local file, "-" - stdout
+ * @param resume Continue partially downloaded file
+ * @return Returns error value
+ */
+int downloadTo(FtpSession &session, const string &path, const string &local, bool resume) {
+  int eCode;
+  session.setType('I'); // binary
+
+  if (local == "-") // stdout can't be continued
+    return resume ? EPARAM : session.transfer("RETR " + path, STDOUT_FILENO);
+
+  struct stat info;
+  bool existed = stat(local.c_str(), &info) == 0;
+  if (resume && existed && info.st_size > 0 &&
+      (eCode = resumeTo(session, path, local, info.st_size)) != EREST)
+    return eCode;
+
+  ostringstream temporary;
+  temporary << local << "." << getpid() << ".part";
+  int fd;
+  if ((fd = open(temporary.str().c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666)) == -1)
+    return EFILE;
+
+  eCode = session.transfer("RETR " + path, fd);
+  if (close(fd) == -1 && eCode == EOK)
+    eCode = EWRITE;
+
+  if (eCode == EOK) {
+    if (rename(temporary.str().c_str(), local.c_str()) == -1)
+      eCode = EFILE;
+  } else if (!existed && stat(temporary.str().c_str(), &info) == 0 && info.st_size > 0) {
+    rename(temporary.str().c_str(), local.c_str()); // keep the part for -c
+  }
+  unlink(temporary.str().c_str()); // nothing if it was renamed
+  return eCode;
+}
 
-  for (ptr = list; ptr != NULL; ptr = ptr->ai_next) {
-    if ((socketfd = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol)) == -1)
-      continue;
+/**
+ * Downloads a file named by the url path
+ * @param session Logged in session
+ * @param path Remote file
+ * @param options Program options
+ * @return Returns error value
+ */
+int download(FtpSession &session, const string &path, const TOptions &options) {
+  if (path.empty() || path[path.length() - 1] == '/')
+    return EPARAM;
 
-    if (connect(socketfd, ptr->ai_addr, ptr->ai_addrlen) == -1) {
-      close(socketfd);
-      continue;
-    }
-    break;
+  string local = options.output;
+  if (local.empty()) { // file named after the remote file
+    unsigned long slashPos = path.rfind("/");
+    local = slashPos == string::npos ? path : path.substr(slashPos + 1);
   }
+  return downloadTo(session, path, local, options.resume);
+}
 
-  if (ptr == NULL) {
-    close(socketfd);
-    printECode(ECONNECTION);
-  }
-    
-  freeaddrinfo(list);
-  int code;
-  string order; 
-  string message = "";
-
-  code = readSocket(&message, socketfd);
-  if (code == 220 || url.auth) {
-    order = "USER " + url.user + "\r\n";  
-    if (send(socketfd, order.c_str(), order.length(), 0) == -1) {
-      close(socketfd);
-      printECode(ESEND);
-    }
-    code = readSocket(&message, socketfd);
+/**
+ * Lists remote directory to stdout
+ * @param session Logged in session
+ * @param order LIST or NLST
+ * @param path Remote directory
+ * @return Returns error value
+ */
+int list(FtpSession &session, const string &order, const string &path) {
+  session.setType('A'); // ASCII
 
-    order = "PASS " + url.password + "\r\n";  
-    if (send(socketfd, order.c_str(), order.length(), 0) == -1) {
-      close(socketfd);
-      printECode(ESEND);
-    }
+  // listing is written to stdout as it arrives
+  return session.transfer(path.empty() ? order : order + " " + path, STDOUT_FILENO);
+}
 
-    if ((code = readSocket(&message, socketfd)) != 230) {
-      close(socketfd);
-      printECode(ELOGING);
+/**
+ * Gets modify time of a remote directory by MLST, or by MDTM if MLST
+ * is not supported
+ * @param session Logged in session
+ * @param dir Remote directory
+ * @param modify Modify time is returned here, empty if not available
+ * @return Returns error value
+ */
+int directoryModify(FtpSession &session, const string &dir, string *modify) {
+  TReply reply;
+  TEntry entry;
+  int eCode;
+
+  modify->clear();
+  if ((eCode = session.command(dir.empty() ? "MLST" : "MLST " + dir, &reply)) != EOK)
+    return eCode;
+
+  if (reply.code == 250) { // 250-Listing CRLF SP facts; name CRLF 250 End
+    unsigned long linePos = reply.text.find("\r\n ");
+    if (linePos != string::npos) {
+      string line = reply.text.substr(linePos + 3);
+      line.erase(line.find("\r\n") == string::npos ? line.length() : line.find("\r\n"));
+      if (parseFacts(line, &entry, true))
+        *modify = entry.modify;
     }
-  }  
-
-  order = "MODE S\r\n"; // set mode to stream 
-  if (send(socketfd, order.c_str(), order.length(), 0) == -1) {
-    close(socketfd);
-    printECode(ESEND);
+  } else if (!dir.empty()) {
+    if ((eCode = session.command("MDTM " + dir, &reply)) != EOK)
+      return eCode;
+    if (reply.code == 213 && reply.text.length() > 4)
+      *modify = reply.text.substr(4);
   }
-  code = readSocket(&message, socketfd);
+  return EOK;
+}
 
-  order = "TYPE A\r\n"; // ASCII
-  if (send(socketfd, order.c_str(), order.length(), 0) == -1) {
-    close(socketfd);
-    printECode(ESEND);
+/**
+ * Gets listing of a remote directory. MLSD is used if requested (LIST if the
+ * server does not support it). If the cache is enabled, the listing is taken
+ * from the cache as long as modify time of the directory has not changed.
+ * @param session Logged in session
+ * @param url Url of the session, host and user are part of the cache key
+ * @param options Program options
+ * @param dir Remote directory
+ * @param listing Listing is returned here
+ * @return Returns error value
+ */
+int fetchListing(FtpSession &session, const TUrl &url, const TOptions &options,
+                 const string &dir, TListing *listing) {
+  ListingCache cache(options.cache);
+  string key = url.user + "@" + url.host + ":" + url.port + "/" + dir;
+  string modify;
+  int eCode;
+
+  listing->mlsd = options.mlsd;
+  if (cache.enabled()) {
+    if ((eCode = directoryModify(session, dir, &modify)) != EOK)
+      return eCode;
+    if (cache.load(key, modify, listing))
+      return EOK;
   }
-  code = readSocket(&message, socketfd);
 
-  order = "PASV\r\n"; // pasive conection
-  if (send(socketfd, order.c_str(), order.length(), 0) == -1) {
-    close(socketfd);
-    printECode(ESEND);
+  session.setType('A');
+  string order = options.mlsd ? "MLSD" : "LIST";
+  eCode = session.transfer(dir.empty() ? order : order + " " + dir, &listing->text);
+  if (eCode == ETRANSFER && options.mlsd && session.lastCode() >= 500 &&
+      session.lastCode() <= 504) { // MLSD is not supported
+    listing->mlsd = false;
+    eCode = session.transfer(dir.empty() ? "LIST" : "LIST " + dir, &listing->text);
   }
-  code = readSocket(&message, socketfd);
-
-  string ip = "";
-  unsigned port = 0;
-  unsigned long bracketPos;
-  if ((bracketPos = message.find("(")) == string::npos) {
-    close(socketfd);
-    printECode(EPASV);
+  if (eCode != EOK)
+    return eCode;
+
+  parseListing(listing);
+  cache.store(key, modify, *listing);
+  return EOK;
+}
+
+/**
+ * Prints listing to stdout as JSON lines or as received from the server
+ * @param listing Listing of a directory
+ * @param dir Listed directory
+ * @param json Print JSON lines
+ */
+void printListing(const TListing &listing, const string &dir, bool json) {
+  if (!json) {
+    writeAll(STDOUT_FILENO, listing.text.c_str(), listing.text.length());
+    return;
   }
 
-  message.erase(0, bracketPos + 1);
-  unsigned long commaPos;
-  for (int i = 0; i < 4; i++) { // get IP address to connect to
-    if ((commaPos = message.find(",")) == string::npos) {
-      close(socketfd);
-      printECode(EPASV);
-    } 
+  string lines;
+  for (size_t i = 0; i < listing.entries.size(); i++)
+    lines += entryToJson(listing.entries[i], dir) + "\n";
+  writeAll(STDOUT_FILENO, lines.c_str(), lines.length());
+}
 
-    if (ip != "")
-      ip = ip + ".";
+/** Shared state of a recursive walk */
+typedef struct crawl {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  deque<string> dirs; // directories waiting for listing
+  int busy; // workers processing a directory
+  int eCode; // first error
+  TUrl url;
+  TOptions options;
+} TCrawl;
+
+/** Worker of a recursive walk */
+typedef struct worker {
+  TCrawl *crawl;
+  FtpSession *session; // NULL - worker opens its own session
+  pthread_t thread;
+} TWorker;
+
+/** Creates local directory for a remote one (relative to the url path) */
+int makeLocalDir(const TCrawl &crawl, const string &dir, string *local) {
+  *local = crawl.options.output.empty() ? "." : crawl.options.output;
+  string relative = dir.substr(crawl.url.path.length());
+  if (!relative.empty() && relative[0] != '/')
+    *local += "/";
+  *local += relative;
+  if (mkdir(local->c_str(), 0777) == -1 && errno != EEXIST)
+    return EFILE;
+  return EOK;
+}
 
-    ip = ip + message.substr(0, commaPos);
-    
-    message.erase(0, commaPos + 1);
+/**
+ * Lists one directory, prints it, queues its subdirectories and
+ * downloads its files if requested
+ * @return Returns error value
+ */
+int crawlDir(TCrawl &crawl, FtpSession &session, const string &dir) {
+  int eCode;
+  TListing listing;
+  if ((eCode = fetchListing(session, crawl.url, crawl.options, dir, &listing)) != EOK)
+    return eCode;
+
+  string local;
+  if (crawl.options.get && (eCode = makeLocalDir(crawl, dir, &local)) != EOK)
+    return eCode;
+
+  deque<string> subdirs;
+  deque<string> files;
+  for (size_t i = 0; i < listing.entries.size(); i++) {
+    const TEntry &entry = listing.entries[i];
+    if (!isEntryName(entry.name)) // would be created outside the local directory
+      continue;
+    if (entry.type == 'd')
+      subdirs.push_back(dir.empty() ? entry.name : dir + "/" + entry.name);
+    else if (entry.type == 'f')
+      files.push_back(entry.name);
   }
 
-  if ((commaPos = message.find(",")) == string::npos) {
-    close(socketfd);
-    printECode(EPASV);
+  pthread_mutex_lock(&crawl.lock);
+  if (crawl.options.json) {
+    printListing(listing, dir, true);
+  } else if (!crawl.options.get) { // print listing the same way as ls -R
+    string header = (dir.empty() ? "." : dir) + ":\n";
+    writeAll(STDOUT_FILENO, header.c_str(), header.length());
+    printListing(listing, dir, false);
+    writeAll(STDOUT_FILENO, "\n", 1);
   }
-
-  port = atoi(message.substr(0, commaPos).c_str()) * 256;
-  message.erase(0, commaPos + 1);
-  
-  if ((bracketPos = message.find(")")) == string::npos) {
-    close(socketfd);
-    printECode(EPASV);
+  crawl.dirs.insert(crawl.dirs.end(), subdirs.begin(), subdirs.end());
+  pthread_cond_broadcast(&crawl.changed);
+  pthread_mutex_unlock(&crawl.lock);
+
+  for (size_t i = 0; crawl.options.get && i < files.size(); i++) {
+    string path = dir.empty() ? files[i] : dir + "/" + files[i];
+    if ((eCode = downloadTo(session, path, local + "/" + files[i], crawl.options.resume)) != EOK)
+      return eCode;
   }
+  return EOK;
+}
 
-  port += atoi(message.substr(0, bracketPos).c_str());
+/** Takes directories from the queue until the whole tree is walked */
+void *crawlWorker(void *arg) {
+  TWorker *worker = (TWorker *)arg;
+  TCrawl &crawl = *worker->crawl;
+  FtpSession ownSession;
+  FtpSession &session = worker->session ? *worker->session : ownSession;
+  int eCode = EOK;
 
-  ostringstream convert;
-  convert << port;
-  const string portStr = convert.str();
-  
-  // connect to data socket:
-  int stat2;
-  struct addrinfo setting2;
-  struct addrinfo *list2;
-  struct addrinfo *ptr2;
-  int socketfd2;
-  memset(&setting2, 0, sizeof setting2); // make the struct empty
-  setting2.ai_family = AF_INET;
-  setting2.ai_socktype = SOCK_STREAM; 
-  setting2.ai_protocol = 0;
-  if ((stat2 = getaddrinfo(ip.c_str(), portStr.c_str(), &setting2, &list2)) != 0) {
-    close(socketfd);
-    printECode(EHOST);
+  if (worker->session == NULL && ownSession.open(crawl.url) != EOK)
+    return NULL; // remaining workers do the work
+
+  pthread_mutex_lock(&crawl.lock);
+  while (1) {
+    while (crawl.dirs.empty() && crawl.busy > 0)
+      pthread_cond_wait(&crawl.changed, &crawl.lock);
+    if (crawl.dirs.empty()) // nothing to do and nobody can add more
+      break;
+
+    string dir = crawl.dirs.front();
+    crawl.dirs.pop_front();
+    crawl.busy++;
+    pthread_mutex_unlock(&crawl.lock);
+
+    eCode = crawlDir(crawl, session, dir);
+    if (eCode != EOK)
+      cerr << (dir.empty() ? "." : dir) << ": " << ECODEMSG[eCode] << endl;
+
+    pthread_mutex_lock(&crawl.lock);
+    crawl.busy--;
+    if (eCode != EOK && crawl.eCode == EOK)
+      crawl.eCode = eCode;
+    pthread_cond_broadcast(&crawl.changed);
+    if (eCode == ERECV || eCode == ESEND) // session is broken
+      break;
   }
+  pthread_mutex_unlock(&crawl.lock);
 
+  if (worker->session == NULL)
+    ownSession.quit();
+  return NULL;
+}
 
-  for (ptr2 = list2; ptr2 != NULL; ptr2 = ptr2->ai_next) {
-    if ((socketfd2 = socket(ptr2->ai_family, ptr2->ai_socktype, ptr2->ai_protocol)) == -1)
-      continue;
-
-    if (connect(socketfd2, ptr2->ai_addr, ptr2->ai_addrlen) == -1) {
-      close(socketfd2);
-      continue;
-    }
-    break;
+/**
+ * Walks the directory tree with several sessions in parallel, prints
+ * listings or downloads the files
+ * @param session Logged in session, used by the first worker
+ * @param url Url of the root directory
+ * @param options Program options
+ * @return Returns error value
+ */
+int crawl(FtpSession &session, const TUrl &url, const TOptions &options) {
+  TCrawl crawl;
+  pthread_mutex_init(&crawl.lock, NULL);
+  pthread_cond_init(&crawl.changed, NULL);
+  crawl.busy = 0;
+  crawl.eCode = EOK;
+  crawl.url = url;
+  crawl.options = options;
+  crawl.dirs.push_back(url.path);
+
+  TWorker workers[MAXJOBS];
+  for (int i = 0; i < options.jobs; i++) {
+    workers[i].crawl = &crawl;
+    workers[i].session = i == 0 ? &session : NULL;
+    if (i > 0 && pthread_create(&workers[i].thread, NULL, crawlWorker, &workers[i]) != 0)
+      workers[i].crawl = NULL;
   }
-
-  if (ptr2 == NULL) {
-    close(socketfd);
-    printECode(ECONNECTION);
+  crawlWorker(&workers[0]);
+  for (int i = 1; i < options.jobs; i++) {
+    if (workers[i].crawl != NULL)
+      pthread_join(workers[i].thread, NULL);
   }
 
+  if (crawl.eCode == EOK && !crawl.dirs.empty()) // all sessions failed
+    crawl.eCode = ECONNECTION;
 
-  struct timeval tv;
-  tv.tv_sec = 1;
-  tv.tv_usec = 0;
+  pthread_cond_destroy(&crawl.changed);
+  pthread_mutex_destroy(&crawl.lock);
+  return crawl.eCode;
+}
 
-  setsockopt(socketfd2, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(struct timeval));
+/** Commands without data connection allowed in a batch, sent pipelined */
+const char *SIMPLECMDS[] = {
+  "CWD", "CDUP", "PWD", "SIZE", "MDTM", "MLST", "NOOP", "STAT", "SYST",
+  "FEAT", "HELP", "SITE", "MKD", "RMD", "DELE", NULL
+};
 
+/** Checks whether the command is in SIMPLECMDS */
+bool isSimpleCommand(const string &order) {
+  string word = order.substr(0, order.find(" "));
+  for (int i = 0; SIMPLECMDS[i] != NULL; i++) {
+    if (word == SIMPLECMDS[i])
+      return true;
+  }
+  return false;
+}
 
-  order = "LIST "+ url.path +"\r\n"; // get list of files
-  if (send(socketfd, order.c_str(), order.length(), 0) == -1) {
-    close(socketfd2);
-    close(socketfd);
-    printECode(ESEND);
-  } 
-  code = readSocket(&message, socketfd);
+/** Checks whether the command changes the working directory (CWD, CDUP) */
+bool isDirectoryChange(const string &order) {
+  string word = order.substr(0, order.find(" "));
+  return word == "CWD" || word == "CDUP";
+}
 
-  int check;
-  char buffer[BUFFSIZE];
-  string text = "";
-  memset(&buffer, 0, sizeof buffer); // make the buffer empty
+/** Prints latency of a batch command to stderr */
+void reportLatency(long long start, long long end, const string &status, const string &order) {
+  cerr << fixed << setprecision(3) << (end - start) / 1E6 << " ms\t"
+       << status << "\t" << order << endl;
+}
 
-  while ((check = recv(socketfd2, buffer, BUFFSIZE - 1, 0)) > 0) {
-    text += buffer;
-    memset(&buffer, 0, sizeof buffer); // make the buffer empty
+/**
+ * Runs commands from a file in one session. Every line contains a path
+ * to be listed or a command: LIST [path], NLST [path], RETR path[<TAB>local]
+ * or one of SIMPLECMDS. The local file of RETR is separated by a tab, as
+ * both paths may contain spaces. Consecutive simple commands are sent at once
+ * and their replies are printed to stdout. CWD and CDUP end such a group,
+ * following commands are not sent until the directory is changed, and the
+ * batch stops if it is not. Latency of each command is printed to stderr.
+ * @param session Logged in session
+ * @param file File with commands, "-" - stdin
+ * @return Returns error value of the first failed command
+ */
+int batch(FtpSession &session, const string &file) {
+  ifstream input;
+  if (file != "-") {
+    input.open(file.c_str());
+    if (!input)
+      return EFILE;
   }
-
-  if (check == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
-    close(socketfd2);
-    close(socketfd);
-    printECode(ERECV);
+  istream &in = file == "-" ? cin : input;
+
+  vector<string> orders;
+  string line;
+  while (getline(in, line)) {
+    if (!line.empty() && line[line.length() - 1] == '\r')
+      line.erase(line.length() - 1);
+    line.erase(0, line.find_first_not_of(" \t"));
+    if (!line.empty() && line[0] != '#')
+      orders.push_back(line);
   }
 
-  cout<< text;
+  int result = EOK;
+  int eCode = EOK;
+  bool lost = false; // working directory is not the one the batch expects
+  size_t i = 0;
+  while (i < orders.size() && eCode != ERECV && eCode != ESEND && !lost) {
+    long long start = monotonicNs();
+    const string &order = orders[i];
+
+    if (isSimpleCommand(order)) { // pipeline following simple commands
+      vector<string> group;
+      while (i < orders.size() && isSimpleCommand(orders[i])) {
+        group.push_back(orders[i++]);
+        if (isDirectoryChange(group.back()))
+          break; // following commands depend on its result
+      }
 
+      vector<TReply> replies;
+      vector<long long> times;
+      eCode = session.commands(group, &replies, &times);
+      for (size_t j = 0; j < times.size(); j++) {
+        string text = replies[j].text + "\n";
+        writeAll(STDOUT_FILENO, text.c_str(), text.length());
+        ostringstream code;
+        code << replies[j].code;
+        reportLatency(start, times[j], code.str(), group[j]);
+      }
+      if (times.size() == group.size() && isDirectoryChange(group.back()) &&
+          replies.back().code / 100 != 2) {
+        cerr << "Batch stopped, directory was not changed: " << group.back() << endl;
+        lost = true;
+        if (eCode == EOK)
+          eCode = ETRANSFER;
+      }
+    } else {
+      string word = order.substr(0, order.find(" "));
+      string arg = word.length() < order.length() ? order.substr(word.length() + 1) : "";
+      if (word == "LIST" || word == "NLST") {
+        eCode = list(session, word, arg);
+      } else if (word == "RETR") {
+        string local;
+        unsigned long tabPos = arg.find("\t");
+        if (tabPos != string::npos) { // RETR path<TAB>local, paths may contain spaces
+          local = arg.substr(tabPos + 1);
+          arg.erase(tabPos);
+        } else {
+          local = arg.substr(arg.rfind("/") + 1);
+        }
+        eCode = arg.empty() || local.empty() ? EPARAM : downloadTo(session, arg, local, false);
+      } else { // path to be listed
+        eCode = list(session, "LIST", order);
+      }
+      reportLatency(start, monotonicNs(), eCode == EOK ? "OK" : ECODEMSG[eCode], order);
+      i++;
+    }
 
-  order = "QUIT\r\n"; 
-  if (send(socketfd, order.c_str(), order.length(), 0) == -1) {
-    close(socketfd2);
-    close(socketfd);
-    printECode(ESEND);
+    if (eCode != EOK && result == EOK)
+      result = eCode;
   }
-  code = readSocket(&message, socketfd);
+  return result;
+}
+
+//////// MAIN PROGRAM ////////
+int main (int argc, char *argv[]) {
+  
+  TUrl url;
+  TOptions options;
+  int eCode = EOK;
+  if ((eCode = getParams(argc, argv, &url, &options)) != EOK)
+    printECode(eCode);
+
+  FtpSession session;
+  if ((eCode = session.open(url)) != EOK)
+    printECode(eCode);
 
-  close(socketfd);
-  close(socketfd2);
+  if (!options.batch.empty())
+    eCode = batch(session, options.batch);
+  else if (options.recursive)
+    eCode = crawl(session, url, options);
+  else if (options.get)
+    eCode = download(session, url.path, options);
+  else if (options.mlsd || options.json || !options.cache.empty()) {
+    TListing listing;
+    if ((eCode = fetchListing(session, url, options, url.path, &listing)) == EOK)
+      printListing(listing, url.path, options.json);
+  } else
+    eCode = list(session, "LIST", url.path);
+
+  session.quit();
+  printECode(eCode);
 
   return eCode;
 }
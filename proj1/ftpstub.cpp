@@ -0,0 +1,58 @@
+/**
+  * File:    ftpstub.cpp
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Simple FTP client for IPP (project 1)
+  *          Stand-in FTP server on the loopback for testing ftpclient.
+  *          Usage: ftpstub [-p port] [-d depth] [-w width] [-f files]
+  *                 [-s filesize] [-l latency_ms] [-F fragment_bytes]
+  */
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <signal.h>
+
+#include "stub.h"
+
+using namespace std;
+
+//////// MAIN PROGRAM ////////
+int main(int argc, char *argv[]) {
+  TStubConfig config;
+  int port = 2121;
+  stubDefaults(&config);
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      cerr << "Usage: ftpstub [-p port] [-d depth] [-w width] [-f files] [-s filesize]"
+           << " [-l latency_ms] [-F fragment_bytes]" << endl;
+      return EXIT_FAILURE;
+    }
+    if (strcmp(argv[i], "-p") == 0)
+      port = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-d") == 0)
+      config.depth = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-w") == 0)
+      config.width = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-f") == 0)
+      config.files = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-s") == 0)
+      config.fileSize = atoll(argv[++i]);
+    else if (strcmp(argv[i], "-l") == 0)
+      config.latency = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-F") == 0)
+      config.fragment = atoi(argv[++i]);
+    else
+      i = argc; // prints usage
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  FtpStub stub(config);
+  if (stub.listen(port) == -1) {
+    cerr << "Cannot listen on 127.0.0.1:" << port << endl;
+    return EXIT_FAILURE;
+  }
+  cout << "ftpstub listening on 127.0.0.1:" << stub.port() << endl;
+  stub.serve();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,287 @@
+/**
+  * File:    listing.cpp
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Simple FTP client for IPP (project 1)
+  *          Parsing of directory listings (MLSD, RFC 3659 and LIST)
+  *          and on-disk cache of listings.
+  */
+
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "listing.h"
+
+#define CACHEMAGIC "ftpclient-cache 1"
+
+using namespace std;
+
+/** Converts string to lower case */
+static string lower(string str) {
+  for (size_t i = 0; i < str.length(); i++)
+    str[i] = tolower(str[i]);
+  return str;
+}
+
+/**
+ * Checks name of an entry of a listing, it is used as a local file name
+ * @return Returns false for empty name, "." and ".." and names with '/'
+ */
+bool isEntryName(const string &name) {
+  return !name.empty() && name != "." && name != ".." && name.find("/") == string::npos;
+}
+
+/**
+ * Parses one line of MLSD output or the entry line of MLST reply
+ * (facts; name), e.g. "type=file;size=1024;modify=20140323120000; a.txt"
+ * @param line Line without CRLF (and without the leading space of MLST)
+ * @param entry Parsed entry is returned here
+ * @param pathname The name is a path (MLST), it is not checked by isEntryName
+ * @return Returns false for lines that don't describe an entry of the
+ *         directory (cdir, pdir, see isEntryName) or have wrong format
+ */
+bool parseFacts(const string &line, TEntry *entry, bool pathname) {
+  unsigned long spacePos = line.find(" ");
+  if (spacePos == string::npos || spacePos + 1 >= line.length())
+    return false;
+
+  entry->name = line.substr(spacePos + 1);
+  entry->type = 'o';
+  entry->size = -1;
+  entry->modify = "";
+  entry->perm = "";
+  entry->unique = "";
+
+  // facts are separated (and terminated) by ';'
+  size_t start = 0;
+  while (start < spacePos) {
+    size_t end = line.find(";", start);
+    if (end == string::npos || end > spacePos)
+      end = spacePos;
+    string fact = line.substr(start, end - start);
+    start = end + 1;
+
+    unsigned long eqPos = fact.find("=");
+    if (eqPos == string::npos)
+      continue;
+    string name = lower(fact.substr(0, eqPos));
+    string value = fact.substr(eqPos + 1);
+
+    if (name == "type") {
+      value = lower(value);
+      if (value == "cdir" || value == "pdir")
+        return false;
+      if (value == "file")
+        entry->type = 'f';
+      else if (value == "dir")
+        entry->type = 'd';
+      else if (value.compare(0, 12, "os.unix=slin") == 0 || value == "os.unix=symlink")
+        entry->type = 'l';
+    } else if (name == "size" || (name == "sizd" && entry->size == -1)) {
+      entry->size = strtoll(value.c_str(), NULL, 10);
+    } else if (name == "modify") {
+      entry->modify = value;
+    } else if (name == "perm") {
+      entry->perm = value;
+    } else if (name == "unique") {
+      entry->unique = value;
+    }
+  }
+  return pathname || isEntryName(entry->name);
+}
+
+/**
+ * Gets an entry from a line of LIST output. Unix (drwxr-xr-x ...)
+ * and DOS (... <DIR> name) formats are recognized.
+ * @param line Line without CRLF
+ * @param entry Parsed entry is returned here, only name, type and size
+ * @return Returns false if the line has unknown format or the name is not
+ *         accepted by isEntryName
+ */
+bool parseListLine(const string &line, TEntry *entry) {
+  istringstream fields(line);
+  string field;
+  int count = 0;
+
+  entry->type = 'o';
+  entry->size = -1;
+  entry->modify = "";
+  entry->perm = "";
+  entry->unique = "";
+
+  if (line.empty())
+    return false;
+  if (line[0] == 'd' || line[0] == '-' || line[0] == 'l') {
+    // perms links owner group size month day time name
+    entry->type = line[0] == 'd' ? 'd' : (line[0] == 'l' ? 'l' : 'f');
+    while (count < 8 && fields >> field) {
+      if (++count == 5)
+        entry->size = strtoll(field.c_str(), NULL, 10);
+    }
+    if (count < 8)
+      return false;
+  } else if (isdigit(line[0])) { // date time <DIR>|size name
+    while (count < 3 && fields >> field)
+      count++;
+    if (count < 3)
+      return false;
+    entry->type = field == "<DIR>" ? 'd' : 'f';
+    if (entry->type == 'f')
+      entry->size = strtoll(field.c_str(), NULL, 10);
+  } else {
+    return false;
+  }
+
+  fields >> ws;
+  getline(fields, entry->name);
+  unsigned long arrowPos;
+  if (entry->type == 'l' && (arrowPos = entry->name.find(" -> ")) != string::npos)
+    entry->name.erase(arrowPos); // link target
+
+  return isEntryName(entry->name);
+}
+
+/** Fills entries of the listing from its text */
+void parseListing(TListing *listing) {
+  istringstream lines(listing->text);
+  string line;
+  TEntry entry;
+
+  listing->entries.clear();
+  while (getline(lines, line)) {
+    if (!line.empty() && line[line.length() - 1] == '\r')
+      line.erase(line.length() - 1);
+    if (listing->mlsd ? parseFacts(line, &entry) : parseListLine(line, &entry))
+      listing->entries.push_back(entry);
+  }
+}
+
+/** Returns string as JSON string literal */
+static string jsonString(const string &str) {
+  string json = "\"";
+  for (size_t i = 0; i < str.length(); i++) {
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\') {
+      json += '\\';
+      json += c;
+    } else if (c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof escaped, "\\u%04x", c);
+      json += escaped;
+    } else {
+      json += c;
+    }
+  }
+  return json + "\"";
+}
+
+/**
+ * Converts entry to one line of JSON
+ * @param entry Entry of a listing
+ * @param dir Listed directory
+ */
+string entryToJson(const TEntry &entry, const string &dir) {
+  ostringstream json;
+  const char *type = entry.type == 'd' ? "dir" : entry.type == 'f' ? "file" :
+                     entry.type == 'l' ? "link" : "other";
+
+  json << "{\"dir\":" << jsonString(dir)
+       << ",\"name\":" << jsonString(entry.name)
+       << ",\"type\":\"" << type << "\"";
+  if (entry.size >= 0)
+    json << ",\"size\":" << entry.size;
+  if (!entry.modify.empty())
+    json << ",\"modify\":" << jsonString(entry.modify);
+  if (!entry.perm.empty())
+    json << ",\"perm\":" << jsonString(entry.perm);
+  if (!entry.unique.empty())
+    json << ",\"unique\":" << jsonString(entry.unique);
+  json << "}";
+  return json.str();
+}
+
+/**
+ * @param directory Directory for cache files, empty - cache is disabled
+ */
+ListingCache::ListingCache(const string &directory) {
+  dir = directory;
+  if (enabled())
+    mkdir(dir.c_str(), 0777);
+}
+
+/** Returns cache file for given key (FNV-1a hash of the key) */
+string ListingCache::fileName(const string &key) {
+  unsigned long long hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < key.length(); i++) {
+    hash ^= (unsigned char)key[i];
+    hash *= 1099511628211ULL;
+  }
+  char name[17];
+  snprintf(name, sizeof name, "%016llx", hash);
+  return dir + "/" + name;
+}
+
+/**
+ * Loads cached listing if the remote directory has not been modified
+ * @param key Host, port and path of the directory
+ * @param modify Current modify time of the directory
+ * @param listing Requested format is taken from listing->mlsd (LIST listing
+ *        is accepted for MLSD request, it is cached if the server does
+ *        not support MLSD), text and entries are returned here
+ * @return Returns true if a valid cached listing was found
+ */
+bool ListingCache::load(const string &key, const string &modify, TListing *listing) {
+  if (!enabled() || modify.empty())
+    return false;
+
+  ifstream file(fileName(key).c_str());
+  string magic, cachedKey, format, cachedModify;
+  if (!getline(file, magic) || !getline(file, cachedKey) ||
+      !getline(file, format) || !getline(file, cachedModify))
+    return false;
+  if (magic != CACHEMAGIC || cachedKey != key || cachedModify != modify ||
+      (format == "MLSD" && !listing->mlsd))
+    return false;
+  listing->mlsd = format == "MLSD";
+
+  ostringstream text;
+  text << file.rdbuf();
+  listing->text = text.str();
+  parseListing(listing);
+  return true;
+}
+
+/**
+ * Stores listing, the file is replaced atomically
+ * @param key Host, port and path of the directory
+ * @param modify Modify time of the directory
+ * @param listing Listing to be stored
+ */
+void ListingCache::store(const string &key, const string &modify, const TListing &listing) {
+  if (!enabled() || modify.empty())
+    return;
+
+  string name = fileName(key);
+  string tmpName = name + ".XXXXXX";
+  vector<char> tmp(tmpName.begin(), tmpName.end());
+  tmp.push_back('\0');
+  int fd;
+  if ((fd = mkstemp(&tmp[0])) == -1)
+    return;
+  close(fd);
+
+  ofstream file(&tmp[0]);
+  file << CACHEMAGIC << "\n" << key << "\n" << (listing.mlsd ? "MLSD" : "LIST") << "\n"
+       << modify << "\n" << listing.text;
+  file.close();
+  if (!file || rename(&tmp[0], name.c_str()) == -1)
+    unlink(&tmp[0]);
+}
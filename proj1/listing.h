@@ -0,0 +1,54 @@
+/**
+  * File:    listing.h
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Simple FTP client for IPP (project 1)
+  *          Parsing of directory listings (MLSD, RFC 3659 and LIST)
+  *          and on-disk cache of listings.
+  */
+
+#ifndef LISTING_H
+#define LISTING_H
+
+#include <string>
+#include <vector>
+
+/** One entry of a directory listing */
+typedef struct entry {
+  std::string name;
+  char type; // 'd' - directory, 'f' - file, 'l' - link, 'o' - other
+  long long size; // -1 if unknown
+  std::string modify; // YYYYMMDDHHMMSS[.sss] (UTC), empty if unknown
+  std::string perm; // MLSD perm fact
+  std::string unique; // MLSD unique fact
+} TEntry;
+
+/** Listing of a directory */
+typedef struct listing {
+  std::string text; // listing as received from the server
+  bool mlsd; // text is MLSD output
+  std::vector<TEntry> entries;
+} TListing;
+
+bool isEntryName(const std::string &name);
+bool parseFacts(const std::string &line, TEntry *entry, bool pathname = false);
+bool parseListLine(const std::string &line, TEntry *entry);
+void parseListing(TListing *listing);
+std::string entryToJson(const TEntry &entry, const std::string &dir);
+
+/**
+ * Cache of listings stored in a directory, one file per remote directory.
+ * A cached listing is valid as long as modify time of the remote
+ * directory does not change.
+ */
+class ListingCache {
+  public:
+    ListingCache(const std::string &directory);
+    bool enabled() const { return !dir.empty(); }
+    bool load(const std::string &key, const std::string &modify, TListing *listing);
+    void store(const std::string &key, const std::string &modify, const TListing &listing);
+  private:
+    std::string fileName(const std::string &key);
+    std::string dir;
+};
+
+#endif
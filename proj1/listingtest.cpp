@@ -0,0 +1,159 @@
+/**
+  * File:    listingtest.cpp
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Simple FTP client for IPP (project 1)
+  *          Test of the listing parsers and of the mirror (ftpclient -r -g)
+  *          with names which must not become local file names.
+  *          Usage: listingtest [ftpclient]
+  */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <unistd.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "listing.h"
+#include "stub.h"
+
+#define MIRRORTIMEOUT 20 // s for the mirror of the small tree
+
+using namespace std;
+
+static int failures = 0;
+
+/** Reports a failed check */
+void check(bool condition, const string &what) {
+  if (condition)
+    return;
+  cout << "FAILED: " << what << endl;
+  failures++;
+}
+
+/** Checks that a line of MLSD is accepted or rejected as expected */
+void checkFacts(const string &line, bool accepted) {
+  TEntry entry;
+  check(parseFacts(line, &entry) == accepted, "MLSD \"" + line + "\"");
+}
+
+/** Checks that a line of LIST is accepted or rejected as expected */
+void checkListLine(const string &line, bool accepted) {
+  TEntry entry;
+  check(parseListLine(line, &entry) == accepted, "LIST \"" + line + "\"");
+}
+
+/** Names which are not plain names of an entry */
+void testNames() {
+  const char *bad[] = {".", "..", "../x", "a/b", "/etc", "d0/", NULL};
+  for (int i = 0; bad[i] != NULL; i++) {
+    string name = bad[i];
+    checkFacts("type=dir;modify=20140323120000;perm=el; " + name, false);
+    checkFacts("type=file;size=1;modify=20140323120000; " + name, false);
+    checkListLine("drwxr-xr-x    2 ftp      ftp          4096 Mar 23 12:00 " + name, false);
+    checkListLine("-rw-r--r--    1 ftp      ftp             1 Mar 23 12:00 " + name, false);
+    checkListLine("03-23-14  12:00PM       <DIR>          " + name, false);
+  }
+  checkFacts("type=file;size=1; ", false);
+  checkListLine("-rw-r--r--    1 ftp      ftp             1 Mar 23 12:00 ", false);
+  checkListLine("lrwxrwxrwx    1 ftp      ftp             1 Mar 23 12:00 .. -> /", false);
+
+  checkFacts("type=dir;modify=20140323120000;perm=el; d0", true);
+  checkFacts("type=file;size=1; my file..txt", true);
+  checkFacts("type=file;size=1; .hidden", true);
+  checkListLine("-rw-r--r--    1 ftp      ftp             1 Mar 23 12:00 my file.txt", true);
+  checkListLine("lrwxrwxrwx    1 ftp      ftp             1 Mar 23 12:00 up -> ../x", true);
+
+  TEntry entry;
+  check(parseFacts("type=dir;modify=20140323120000; /d0/d1", &entry, true) &&
+        entry.name == "/d0/d1", "MLST path");
+}
+
+/** Parsed listing keeps only plain names */
+void testListing() {
+  TListing listing;
+  listing.mlsd = true;
+  listing.text = "type=cdir; .\r\ntype=pdir; ..\r\ntype=dir; .\r\ntype=dir; ..\r\n"
+                 "type=dir; ../up\r\ntype=file;size=1; a/b\r\ntype=file;size=1; ok.dat\r\n";
+  parseListing(&listing);
+  check(listing.entries.size() == 1 && listing.entries[0].name == "ok.dat", "MLSD listing");
+}
+
+/** Returns number of entries of a local directory, -1 if it can't be read */
+int countEntries(const string &path) {
+  DIR *dir = opendir(path.c_str());
+  if (dir == NULL)
+    return -1;
+  int count = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL)
+    if (string(entry->d_name) != "." && string(entry->d_name) != "..")
+      count++;
+  closedir(dir);
+  return count;
+}
+
+/**
+ * Mirrors a tree whose listings contain ., .., ../up.dat and d0/in.dat.
+ * The mirror must end and must not write outside its directory.
+ * @param client Path to ftpclient
+ * @param mlsd List with MLSD instead of LIST
+ */
+void testMirror(const string &client, bool mlsd) {
+  TStubConfig config;
+  stubDefaults(&config);
+  config.depth = 1;
+  config.width = 2;
+  config.files = 2;
+  config.fileSize = 100;
+  config.hostile = true;
+  FtpStub stub(config);
+  ostringstream url;
+  url << "ftp://127.0.0.1:" << stub.start() << "/";
+
+  char base[] = "/tmp/listingtest.XXXXXX";
+  if (mkdtemp(base) == NULL) {
+    check(false, "temporary directory");
+    return;
+  }
+  string mirror = string(base) + "/mirror";
+  string name = mlsd ? "mirror with MLSD" : "mirror with LIST";
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    alarm(MIRRORTIMEOUT); // kills a mirror which never ends
+    if (mlsd)
+      execl(client.c_str(), client.c_str(), "-r", "-g", "-M", "-o", mirror.c_str(),
+            url.str().c_str(), (char *)NULL);
+    else
+      execl(client.c_str(), client.c_str(), "-r", "-g", "-o", mirror.c_str(),
+            url.str().c_str(), (char *)NULL);
+    _exit(127);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  check(WIFEXITED(status) && WEXITSTATUS(status) == 0, name + ": ftpclient failed or hung");
+  check(countEntries(base) == 1, name + ": file written outside the mirror");
+  check(countEntries(mirror) == 4, name + ": d0, d1, f0.dat and f1.dat expected");
+  check(countEntries(mirror + "/d0") == 2, name + ": f0.dat and f1.dat expected in d0");
+
+  string command = string("rm -rf ") + base;
+  if (system(command.c_str()) != 0)
+    cout << "listingtest: " << base << " was not removed" << endl;
+}
+
+//////// MAIN PROGRAM ////////
+int main(int argc, char *argv[]) {
+  string client = argc > 1 ? argv[1] : "./ftpclient";
+  signal(SIGPIPE, SIG_IGN);
+  testNames();
+  testListing();
+  testMirror(client, true);
+  testMirror(client, false);
+  cout << (failures ? "listingtest: failed" : "listingtest: OK") << endl;
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
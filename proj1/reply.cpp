@@ -0,0 +1,148 @@
+/**
+  * File:    reply.cpp
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Simple FTP client for IPP (project 1)
+  *          Incremental reader of FTP replies (RFC 959, section 4.2).
+  */
+
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "reply.h"
+
+using namespace std;
+
+ReplyReader::ReplyReader(int socketfd) {
+  fd = socketfd;
+  start = 0;
+  end = 0;
+  current.code = 0;
+  multiline = false;
+  memset(code, 0, sizeof code);
+}
+
+void ReplyReader::setSocket(int socketfd) {
+  fd = socketfd;
+}
+
+/**
+ * Receives data from the socket into the buffer (one recv call)
+ * @return Returns number of received bytes, 0 if the connection was closed,
+ *         -1 on error
+ */
+int ReplyReader::fill() {
+  if (start == end)
+    start = end = 0;
+  if (end == REPLYBUFFSIZE)
+    return REPLYBUFFSIZE - start; // call next() first
+
+  ssize_t check;
+  do {
+    check = recv(fd, buffer + end, REPLYBUFFSIZE - end, 0);
+  } while (check == -1 && errno == EINTR);
+
+  if (check > 0)
+    end += check;
+  return check;
+}
+
+/**
+ * Adds data to the buffer as if they were received from the socket
+ * @return Returns number of accepted bytes (limited by free space)
+ */
+size_t ReplyReader::feed(const char *data, size_t length) {
+  if (start == end)
+    start = end = 0;
+  size_t free = REPLYBUFFSIZE - end;
+  if (length > free)
+    length = free;
+  memcpy(buffer + end, data, length);
+  end += length;
+  return length;
+}
+
+/**
+ * Processes one complete line (without CRLF) stored in line
+ * @return Returns true if the line finished the reply
+ */
+bool ReplyReader::processLine(TReply *reply) {
+  bool hasCode = line.length() >= 3 && isdigit(line[0]) && isdigit(line[1]) &&
+                 isdigit(line[2]);
+
+  if (!multiline) {
+    current.text.clear();
+    current.code = hasCode ? (line[0] - '0') * 100 + (line[1] - '0') * 10 + (line[2] - '0') : 0;
+  } else if (current.text.length() < MAXREPLYSIZE) {
+    current.text += "\r\n";
+  }
+
+  if (current.text.length() < MAXREPLYSIZE)
+    current.text.append(line, 0, MAXREPLYSIZE - current.text.length());
+
+  if (!multiline) {
+    if (hasCode && line.length() > 3 && line[3] == '-') { // first line of multi-line reply
+      multiline = true;
+      memcpy(code, line.data(), 3);
+      line.clear();
+      return false;
+    }
+  } else if (!(hasCode && memcmp(code, line.data(), 3) == 0 &&
+              (line.length() == 3 || line[3] == ' '))) {
+    line.clear();
+    return false; // not the last line yet
+  }
+
+  multiline = false;
+  line.clear();
+  reply->code = current.code;
+  reply->text.swap(current.text);
+  current.text.clear();
+  return true;
+}
+
+/**
+ * Parses buffered data up to the end of the next complete reply
+ * @param reply Complete reply is returned here
+ * @return Returns true if a complete reply was found
+ */
+bool ReplyReader::next(TReply *reply) {
+  while (start < end) {
+    const char *lf = (const char *)memchr(buffer + start, '\n', end - start);
+    size_t stop = lf ? lf - buffer : end;
+    size_t length = stop - start;
+
+    if (line.length() + length > MAXREPLYSIZE) // very long line is truncated
+      length = line.length() < MAXREPLYSIZE ? MAXREPLYSIZE - line.length() : 0;
+    line.append(buffer + start, length);
+
+    if (lf == NULL) { // incomplete line, wait for more data
+      start = end = 0;
+      return false;
+    }
+
+    start = stop + 1;
+    if (!line.empty() && line[line.length() - 1] == '\r')
+      line.erase(line.length() - 1);
+
+    if (processLine(reply))
+      return true;
+  }
+  start = end = 0;
+  return false;
+}
+
+/**
+ * Reads the next reply, receives from the socket only if needed
+ * @param reply Complete reply is returned here
+ * @return Returns 0 on success, -1 if the connection failed or was closed
+ */
+int ReplyReader::read(TReply *reply) {
+  while (!next(reply)) {
+    if (fill() <= 0)
+      return -1;
+  }
+  return 0;
+}
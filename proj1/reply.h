@@ -0,0 +1,49 @@
+/**
+  * File:    reply.h
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Simple FTP client for IPP (project 1)
+  *          Incremental reader of FTP replies (RFC 959, section 4.2).
+  */
+
+#ifndef REPLY_H
+#define REPLY_H
+
+#include <string>
+#include <cstddef>
+
+#define REPLYBUFFSIZE 4096 // receive buffer of the reader
+#define MAXREPLYSIZE (64 * 1024) // longer reply text is truncated
+
+/** One complete (possibly multi-line) reply */
+typedef struct reply {
+  int code; // 0 if the reply does not start with a 3 digit code
+  std::string text; // all lines of the reply separated by CRLF
+} TReply;
+
+/**
+ * Reads replies from the control connection. Received data are split into
+ * lines as they arrive, so every byte is examined only once. Several replies
+ * received at once are returned one by one by next().
+ */
+class ReplyReader {
+  public:
+    ReplyReader(int socketfd = -1);
+    void setSocket(int socketfd);
+    int socket() const { return fd; }
+    int fill();
+    size_t feed(const char *data, size_t length);
+    bool next(TReply *reply);
+    int read(TReply *reply);
+  private:
+    bool processLine(TReply *reply);
+    int fd;
+    char buffer[REPLYBUFFSIZE];
+    size_t start; // first unprocessed byte in buffer
+    size_t end; // end of received data in buffer
+    std::string line; // incomplete line from previous data
+    TReply current; // reply being read
+    bool multiline; // waiting for the last line of a multi-line reply
+    char code[3]; // code of the multi-line reply
+};
+
+#endif
@@ -0,0 +1,172 @@
+/**
+  * File:    replybench.cpp
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Simple FTP client for IPP (project 1)
+  *          Fuzz test and throughput benchmark of the reply reader.
+  *          Usage: replybench [fuzz iterations] [seed]
+  */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+
+#include "reply.h"
+
+using namespace std;
+
+/** Returns monotonic time in seconds */
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1E9;
+}
+
+/** Random text of a reply line, may start with digits to confuse the reader */
+string randomText() {
+  string text;
+  int length = rand() % 40;
+  for (int i = 0; i < length; i++) {
+    int kind = rand() % 10;
+    if (kind < 3)
+      text += (char)('0' + rand() % 10);
+    else if (kind == 3)
+      text += (rand() % 2) ? '-' : ' ';
+    else
+      text += (char)('a' + rand() % 26);
+  }
+  return text;
+}
+
+/** Generates a random reply, returns its wire form and expected result */
+string randomReply(TReply *expected) {
+  int code = 100 + rand() % 500;
+  ostringstream convert;
+  convert << code;
+  string codeStr = convert.str();
+  string wire;
+
+  expected->code = code;
+  if (rand() % 3) { // single line
+    expected->text = codeStr + " " + randomText();
+    wire = expected->text + "\r\n";
+    return wire;
+  }
+
+  expected->text = codeStr + "-" + randomText();
+  int lines = rand() % 6;
+  for (int i = 0; i < lines; i++) {
+    string line;
+    switch (rand() % 3) {
+      case 0: line = " " + randomText(); break;
+      case 1: line = codeStr + "-" + randomText(); break; // still not the last line
+      default: // line starting with a different code
+        line = (codeStr[0] == '5' ? "4" : "5") + codeStr.substr(1) + " " + randomText();
+        break;
+    }
+    expected->text += "\r\n" + line;
+  }
+  expected->text += "\r\n" + codeStr + " " + randomText();
+  wire = expected->text + "\r\n";
+  return wire;
+}
+
+/** Feeds the stream to the reader in random chunks and collects replies */
+void feedRandomly(ReplyReader &reader, const string &wire, vector<TReply> &replies) {
+  size_t pos = 0;
+  TReply reply;
+  while (pos < wire.length()) {
+    size_t chunk = 1 + rand() % (rand() % 2 ? 8 : REPLYBUFFSIZE);
+    if (chunk > wire.length() - pos)
+      chunk = wire.length() - pos;
+    pos += reader.feed(wire.data() + pos, chunk);
+    while (reader.next(&reply))
+      replies.push_back(reply);
+  }
+}
+
+/**
+ * Random replies are cut into random chunks, every chunk boundary must
+ * give the same replies. Random bytes must not break the reader.
+ * @return Returns number of mismatches
+ */
+int fuzz(int iterations) {
+  int failed = 0;
+  for (int i = 0; i < iterations; i++) {
+    vector<TReply> expected;
+    string wire;
+    int count = 1 + rand() % 20;
+    for (int j = 0; j < count; j++) {
+      TReply reply;
+      wire += randomReply(&reply);
+      expected.push_back(reply);
+    }
+
+    ReplyReader reader;
+    vector<TReply> replies;
+    feedRandomly(reader, wire, replies);
+
+    bool same = replies.size() == expected.size();
+    for (size_t j = 0; same && j < replies.size(); j++)
+      same = replies[j].code == expected[j].code && replies[j].text == expected[j].text;
+    if (!same && failed++ == 0)
+      cerr << "mismatch in iteration " << i << ":" << endl << wire;
+
+    string garbage;
+    int length = rand() % 2000;
+    for (int j = 0; j < length; j++)
+      garbage += (char)(rand() % 4 ? rand() % 256 : '\n');
+    ReplyReader garbageReader;
+    replies.clear();
+    feedRandomly(garbageReader, garbage, replies);
+  }
+  return failed;
+}
+
+/** Measures parsing throughput of given stream split into segments */
+void throughput(const string &name, const string &wire, size_t segment, int rounds) {
+  size_t count = 0;
+  double start = now();
+  for (int i = 0; i < rounds; i++) {
+    ReplyReader reader;
+    TReply reply;
+    size_t pos = 0;
+    while (pos < wire.length()) {
+      size_t chunk = segment < wire.length() - pos ? segment : wire.length() - pos;
+      pos += reader.feed(wire.data() + pos, chunk);
+      while (reader.next(&reply))
+        count++;
+    }
+  }
+  double elapsed = now() - start;
+  double megabytes = (double)wire.length() * rounds / 1E6;
+  cout << name << ": " << megabytes / elapsed << " MB/s, "
+       << count / elapsed << " replies/s" << endl;
+}
+
+//////// MAIN PROGRAM ////////
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+  unsigned seed = argc > 2 ? atoi(argv[2]) : time(NULL);
+  srand(seed);
+
+  int failed = fuzz(iterations);
+  cout << "fuzz: " << iterations << " iterations, seed " << seed << ", "
+       << failed << " failed" << endl;
+
+  string longReply = "211-Status\r\n";
+  for (int i = 0; i < 200000; i++)
+    longReply += " line of a very long multi-line status reply\r\n";
+  longReply += "211 End\r\n";
+  throughput("multi-line reply (200000 lines)", longReply, 1448, 5);
+
+  string pipelined;
+  for (int i = 0; i < 200000; i++)
+    pipelined += "200 Command okay.\r\n";
+  throughput("pipelined replies (200000)", pipelined, 1448, 5);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,472 @@
+/**
+  * File:    session.cpp
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Simple FTP client for IPP (project 1)
+  *          Control connection of a logged in FTP session.
+  */
+
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <ctime>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "session.h"
+#include "../common/connector.h"
+
+using namespace std;
+
+/**
+ * Writes whole buffer to the given descriptor
+ * @return Returns error value
+ */
+int writeAll(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, data, length);
+    if (written == -1) {
+      if (errno == EINTR)
+        continue;
+      return EWRITE;
+    }
+    data += written;
+    length -= written;
+  }
+  return EOK;
+}
+
+/**
+ * Connects to given host and port, addresses are raced (see raceConnect)
+ * @param family AF_INET or AF_UNSPEC
+ * @param fd Descriptor of connected socket is returned here
+ * @return Returns error value
+ */
+static int connectTo(const string &host, const string &port, int family, int *fd) {
+  switch (raceConnect(host, port, family, CONNECT_TIMEOUT, fd)) {
+    case CONNECT_OK:
+      return EOK;
+    case CONNECT_EHOST:
+      return EHOST;
+    default:
+      return ECONNECTION;
+  }
+}
+
+FtpSession::FtpSession() {
+  socketfd = -1;
+  type = 0;
+  wanted = 0;
+  code = 0;
+  modePending = false;
+}
+
+FtpSession::~FtpSession() {
+  if (socketfd != -1)
+    close(socketfd);
+}
+
+/**
+ * Connects to the server from url and logs in
+ * @return Returns error value
+ */
+int FtpSession::open(const TUrl &url) {
+  int eCode;
+  if ((eCode = connectTo(url.host, url.port, AF_UNSPEC, &socketfd)) != EOK)
+    return eCode;
+  reader.setSocket(socketfd);
+  return login(url);
+}
+
+/** Reads the greeting and logs in, stream mode is set with the first command */
+int FtpSession::login(const TUrl &url) {
+  TReply reply;
+  int eCode;
+
+  if (reader.read(&reply) != 0)
+    return ERECV;
+
+  if (reply.code == 220 || url.auth) {
+    if ((eCode = command("USER " + url.user, &reply)) != EOK)
+      return eCode;
+
+    if (reply.code != 230) { // password is not needed if already logged in
+      if ((eCode = command("PASS " + url.password, &reply)) != EOK)
+        return eCode;
+      if (reply.code != 230)
+        return ELOGING;
+    }
+  }
+
+  modePending = true;
+  return EOK;
+}
+
+/** Sends whole buffer to the socket */
+static int sendAll(int fd, const string &data) {
+  size_t sent = 0;
+  while (sent < data.length()) {
+    ssize_t check = send(fd, data.data() + sent, data.length() - sent, 0);
+    if (check == -1) {
+      if (errno == EINTR)
+        continue;
+      return ESEND;
+    }
+    sent += check;
+  }
+  return EOK;
+}
+
+/** Returns monotonic time in nanoseconds */
+long long monotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Sends command and reads its reply
+ * @param order Command without CRLF
+ * @param reply Reply of the server
+ * @return Returns error value
+ */
+int FtpSession::command(const string &order, TReply *reply) {
+  vector<string> orders(1, order);
+  vector<TReply> replies;
+  int eCode = commands(orders, &replies);
+  if (!replies.empty())
+    *reply = replies[0];
+  return eCode;
+}
+
+/**
+ * Sends several commands at once and reads their replies. Pending MODE
+ * and TYPE commands are sent in front of them, so they don't cost
+ * a round trip of their own. Refused MODE or TYPE stays pending, it is
+ * sent again with the next command. At most PIPELINEDEPTH commands wait
+ * for their replies, the next one is sent when a reply is read, so long
+ * replies can't fill both directions of the connection.
+ * @param orders Commands without CRLF
+ * @param replies Replies of the server, in order of commands
+ * @param times Monotonic time of arrival of each reply (ns), may be NULL
+ * @return Returns error value, ETYPE if MODE or TYPE was refused (replies
+ *         of the commands are returned even then)
+ */
+int FtpSession::commands(const vector<string> &orders, vector<TReply> *replies,
+                         vector<long long> *times) {
+  bool sendMode = modePending;
+  bool sendType = wanted != 0 && wanted != type;
+  vector<string> lines;
+  if (sendMode)
+    lines.push_back("MODE S"); // set mode to stream
+  if (sendType)
+    lines.push_back(string("TYPE ") + wanted);
+  size_t first = lines.size(); // line of the first of orders
+  lines.insert(lines.end(), orders.begin(), orders.end());
+
+  replies->clear();
+  if (times != NULL)
+    times->clear();
+  replies->resize(orders.size());
+
+  TReply reply;
+  int eCode = EOK;
+  size_t sent = 0;
+  for (size_t i = 0; i < lines.size(); i++) {
+    if (sent < i + PIPELINEDEPTH && sent < lines.size()) {
+      string data;
+      for (; sent < i + PIPELINEDEPTH && sent < lines.size(); sent++)
+        data += lines[sent] + "\r\n";
+      if (sendAll(socketfd, data) != EOK)
+        return ESEND;
+#ifdef TCP_QUICKACK
+      if (i == 0 && lines.size() > 1) {
+        // acknowledge at once, so a server with Nagle's algorithm sends
+        // pipelined replies without waiting for delayed ACK
+        int on = 1;
+        setsockopt(socketfd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof on);
+      }
+#endif
+    }
+
+    if (reader.read(i < first ? &reply : &(*replies)[i - first]) != 0)
+      return ERECV;
+    if (i >= first) {
+      if (times != NULL)
+        times->push_back(monotonicNs());
+    } else if (sendMode && i == 0) {
+      if (reply.code == 200)
+        modePending = false;
+      else
+        eCode = ETYPE;
+    } else {
+      if (reply.code == 200)
+        type = wanted;
+      else
+        eCode = ETYPE;
+    }
+  }
+  return eCode;
+}
+
+/**
+ * Sets representation type (A - ASCII, I - binary) for following
+ * transfers. TYPE is sent together with the next command and only
+ * if the type differs from the current one.
+ */
+void FtpSession::setType(char newType) {
+  wanted = newType;
+}
+
+/**
+ * Enters passive mode and connects to the data port
+ * @param datafd Descriptor of connected data socket is returned here
+ * @return Returns error value
+ */
+int FtpSession::passive(int *datafd) {
+  TReply reply;
+  int eCode;
+  if ((eCode = command("PASV", &reply)) != EOK) // pasive conection
+    return eCode;
+
+  // 227 Entering Passive Mode (h1,h2,h3,h4,p1,p2)
+  unsigned long bracketPos;
+  if (reply.code != 227 || (bracketPos = reply.text.find("(")) == string::npos)
+    return EPASV;
+
+  unsigned numbers[6];
+  const char *pos = reply.text.c_str() + bracketPos + 1;
+  char *end;
+  for (int i = 0; i < 6; i++) {
+    numbers[i] = strtoul(pos, &end, 10);
+    if (end == pos || numbers[i] > 255 || *end != (i < 5 ? ',' : ')'))
+      return EPASV;
+    pos = end + 1;
+  }
+
+  ostringstream ip;
+  ip << numbers[0] << "." << numbers[1] << "." << numbers[2] << "." << numbers[3];
+  ostringstream port;
+  port << numbers[4] * 256 + numbers[5];
+
+  return connectTo(ip.str(), port.str(), AF_INET, datafd);
+}
+
+/**
+ * Opens data connection and sends a command transferring data from the server
+ * @param order Command without CRLF
+ * @param offset Restart position sent by REST, 0 - from the beginning
+ * @param datafd Descriptor of connected data socket is returned here
+ * @return Returns error value, EREST if REST is not supported
+ */
+int FtpSession::startTransfer(const string &order, off_t offset, int *datafd) {
+  int eCode;
+  if ((eCode = passive(datafd)) != EOK)
+    return eCode;
+
+  if (offset > 0) { // REST must directly precede the transfer command
+    TReply reply;
+    ostringstream rest;
+    rest << "REST " << offset;
+    if ((eCode = command(rest.str(), &reply)) != EOK || reply.code != 350) {
+      close(*datafd);
+      return eCode != EOK ? eCode : EREST;
+    }
+  }
+
+  string line = order + "\r\n";
+  if (send(socketfd, line.c_str(), line.length(), 0) == -1) {
+    close(*datafd);
+    return ESEND;
+  }
+  return EOK;
+}
+
+/**
+ * Runs a command transferring data from the server (LIST, RETR, ...)
+ * @param order Command without CRLF
+ * @param outfd Descriptor to write received data to
+ * @param offset Restart position sent by REST, 0 - from the beginning
+ * @return Returns error value, EREST if REST is not supported
+ */
+int FtpSession::transfer(const string &order, int outfd, off_t offset) {
+  int datafd;
+  int eCode;
+  if ((eCode = startTransfer(order, offset, &datafd)) != EOK)
+    return eCode;
+
+  eCode = receiveData(datafd, outfd, NULL);
+  close(datafd);
+  return eCode;
+}
+
+/**
+ * Runs a command transferring data from the server, data are stored in memory
+ * @param order Command without CRLF
+ * @param output Received data are returned here
+ * @return Returns error value
+ */
+int FtpSession::transfer(const string &order, string *output) {
+  int datafd;
+  int eCode;
+  output->clear();
+  if ((eCode = startTransfer(order, 0, &datafd)) != EOK)
+    return eCode;
+
+  eCode = receiveData(datafd, -1, output);
+  close(datafd);
+  return eCode;
+}
+
+/**
+ * Waits for data and control connection together, data are written to outfd
+ * as they arrive. Transfer is complete when the data connection is closed
+ * by the server and the completion reply (226 or 250) has been received.
+ * On Linux data are moved to the output by splice() if the output allows it.
+ * @param datafd Data connection
+ * @param outfd Descriptor to write received data to
+ * @param output If not NULL, data are appended here instead of outfd
+ * @return Returns error value
+ */
+int FtpSession::receiveData(int datafd, int outfd, string *output) {
+  struct pollfd fds[2];
+  fds[0].fd = socketfd;
+  fds[0].events = POLLIN;
+  fds[1].fd = datafd;
+  fds[1].events = POLLIN;
+
+  bool dataDone = false;
+  bool replyDone = false;
+  int ready;
+  ssize_t check;
+  TReply reply;
+  char *buffer = NULL;
+
+  int pipefd[2] = {-1, -1};
+#ifdef __linux__
+  if (output == NULL && pipe(pipefd) == 0)
+    fcntl(pipefd[1], F_SETPIPE_SZ, DATABUFFSIZE);
+#endif
+
+  int eCode = EOK;
+  while (eCode == EOK && (!dataDone || !replyDone)) {
+    while (!replyDone && reader.next(&reply)) { // 150 and 226 may come at once
+      if (reply.code >= 400 || reply.code < 100) {
+        code = reply.code;
+        eCode = ETRANSFER;
+        break;
+      }
+      if (reply.code >= 200) {
+        replyDone = true;
+        fds[0].fd = -1;
+      }
+    }
+    if (eCode != EOK || (dataDone && replyDone))
+      break;
+
+    if ((ready = poll(fds, 2, TIMEOUT)) == -1) {
+      if (errno == EINTR)
+        continue;
+      eCode = ERECV;
+      break;
+    }
+    if (ready == 0) { // server has stopped responding
+      eCode = ERECV;
+      break;
+    }
+
+    // control connection, replies are processed at the beginning of the loop
+    if (fds[0].revents != 0 && reader.fill() <= 0) {
+      eCode = ERECV;
+      break;
+    }
+
+    if (fds[1].revents == 0) // data connection
+      continue;
+
+#ifdef __linux__
+    if (pipefd[0] != -1) { // zero-copy: socket -> pipe -> output
+      check = splice(datafd, NULL, pipefd[1], NULL, DATABUFFSIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      ssize_t moved = 0;
+      while (check > 0 && moved < check) {
+        ssize_t out = splice(pipefd[0], NULL, outfd, NULL, check - moved, SPLICE_F_MOVE);
+        if (out <= 0)
+          break;
+        moved += out;
+      }
+      if (check > 0 && moved == check)
+        continue;
+      if (check > 0 && moved == 0 && errno == EINVAL) {
+        // output does not support splice, write data from the pipe
+        if (buffer == NULL)
+          buffer = new char[DATABUFFSIZE];
+        while (moved < check) {
+          ssize_t in = read(pipefd[0], buffer, check - moved);
+          if (in <= 0 || writeAll(outfd, buffer, in) != EOK)
+            break;
+          moved += in;
+        }
+        close(pipefd[0]);
+        close(pipefd[1]);
+        pipefd[0] = pipefd[1] = -1;
+        if (moved != check)
+          eCode = EWRITE;
+        continue;
+      }
+      if (check > 0) {
+        eCode = EWRITE;
+        continue;
+      }
+      if (check == -1 && errno == EINVAL) { // socket can't be spliced, use recv
+        close(pipefd[0]);
+        close(pipefd[1]);
+        pipefd[0] = pipefd[1] = -1;
+        continue;
+      }
+    } else
+#endif
+    {
+      if (buffer == NULL)
+        buffer = new char[DATABUFFSIZE];
+      if ((check = recv(datafd, buffer, DATABUFFSIZE, 0)) > 0) {
+        if (output != NULL)
+          output->append(buffer, check);
+        else
+          eCode = writeAll(outfd, buffer, check);
+        continue;
+      }
+    }
+
+    if (check == 0 || errno == ECONNRESET) {
+      // reset data connection is resolved by the completion reply
+      dataDone = true;
+      fds[1].fd = -1; // poll ignores negative descriptors
+    } else if (errno != EINTR && errno != EAGAIN) {
+      eCode = ERECV;
+    }
+  }
+
+  if (pipefd[0] != -1) {
+    close(pipefd[0]);
+    close(pipefd[1]);
+  }
+  delete[] buffer;
+  return eCode;
+}
+
+/** Ends the session */
+void FtpSession::quit() {
+  if (socketfd == -1)
+    return;
+  TReply reply;
+  command("QUIT", &reply);
+  close(socketfd);
+  socketfd = -1;
+}
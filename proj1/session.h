@@ -0,0 +1,84 @@
+/**
+  * File:    session.h
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Simple FTP client for IPP (project 1)
+  *          Control connection of a logged in FTP session.
+  */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#include "reply.h"
+
+#define DATABUFFSIZE (256 * 1024) // buffer for data connection
+#define TIMEOUT 30000 // ms without any activity on control and data connection
+#define PIPELINEDEPTH 16 // commands sent ahead of their replies
+
+/** Error values */
+enum {
+  EOK = 0, // No error detected
+  EPARAMNUM, // Wrong number of parameters
+  EPARAM, // Wrong parameter
+  EPASV, // PASV
+  ERECV, // RECV
+  ESEND, // SEND
+  ECONNECTION,
+  EHOST,
+  ELOGING,
+  ETRANSFER, // Data transfer refused or failed
+  EWRITE,
+  EFILE, // Local file
+  EREST, // REST not supported
+  ETYPE, // MODE or TYPE refused
+  EUNKNOWN // Unknown error
+};
+
+/** Structure for url address */
+typedef struct url {
+  std::string user;
+  std::string password;
+  std::string host;
+  std::string port;
+  std::string path;
+  bool auth;
+} TUrl;
+
+/**
+ * Logged in FTP session. All methods return error values, the session
+ * keeps the control connection open until quit() is called.
+ */
+class FtpSession {
+  public:
+    FtpSession();
+    ~FtpSession();
+    int open(const TUrl &url);
+    int command(const std::string &order, TReply *reply);
+    int commands(const std::vector<std::string> &orders, std::vector<TReply> *replies,
+                 std::vector<long long> *times = NULL);
+    void setType(char type);
+    int passive(int *datafd);
+    int transfer(const std::string &order, int outfd, off_t offset = 0);
+    int transfer(const std::string &order, std::string *output);
+    void quit();
+    int socket() const { return socketfd; }
+    int lastCode() const { return code; }
+  private:
+    int login(const TUrl &url);
+    int startTransfer(const std::string &order, off_t offset, int *datafd);
+    int receiveData(int datafd, int outfd, std::string *output);
+    int socketfd;
+    ReplyReader reader;
+    char type; // current representation type, 0 if unknown
+    char wanted; // type requested by setType()
+    int code; // reply code of the last failed transfer
+    bool modePending; // MODE S is to be sent with the next command
+};
+
+int writeAll(int fd, const char *data, size_t length);
+long long monotonicNs();
+
+#endif
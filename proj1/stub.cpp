@@ -0,0 +1,489 @@
+/**
+  * File:    stub.cpp
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Simple FTP client for IPP (project 1)
+  *          Stand-in FTP server on the loopback serving a synthetic
+  *          directory tree, used by ftpstub and ftpbench.
+  */
+
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "stub.h"
+
+#define STUBBUFFSIZE (64 * 1024)
+#define STUBACCEPTTIMEOUT 10000 // ms to wait for the data connection
+
+using namespace std;
+
+/** Node of the synthetic tree */
+typedef struct node {
+  bool dir;
+  int level; // number of directories above the node
+  string path; // normalized absolute path
+} TNode;
+
+/** Control connection of one client */
+typedef struct client {
+  int fd;
+  TStubConfig config;
+  string cwd; // normalized absolute path
+  int pasvfd; // listening data socket, -1 if PASV was not sent
+  long long rest; // offset from REST
+} TClient;
+
+static char pattern[STUBBUFFSIZE]; // content of files, filled by FtpStub()
+
+void stubDefaults(TStubConfig *config) {
+  config->depth = 2;
+  config->width = 4;
+  config->files = 16;
+  config->fileSize = 4096;
+  config->latency = 0;
+  config->fragment = 0;
+  config->hostile = false;
+}
+
+/** Sends whole buffer, returns false on error */
+static bool sendAll(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+    if (sent == -1) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += sent;
+    length -= sent;
+  }
+  return true;
+}
+
+/**
+ * Sends reply after the configured latency, the reply is split into
+ * fragments sent as separate segments if requested
+ * @param text Reply without the final CRLF, lines separated by CRLF
+ */
+static bool reply(TClient *client, const string &text) {
+  string wire = text + "\r\n";
+  if (client->config.latency > 0)
+    usleep(client->config.latency * 1000);
+
+  size_t fragment = client->config.fragment > 0 ? client->config.fragment : wire.length();
+  for (size_t pos = 0; pos < wire.length(); pos += fragment) {
+    if (pos > 0)
+      usleep(STUBFRAGMENTGAP);
+    if (!sendAll(client->fd, wire.data() + pos, min(fragment, wire.length() - pos)))
+      return false;
+  }
+  return true;
+}
+
+/** Parses name of the form prefix<number>suffix, returns number or -1 */
+static int nameIndex(const string &name, const char *prefix, const char *suffix) {
+  size_t prefixLength = strlen(prefix);
+  size_t suffixLength = strlen(suffix);
+  if (name.length() <= prefixLength + suffixLength ||
+      name.compare(0, prefixLength, prefix) != 0 ||
+      name.compare(name.length() - suffixLength, suffixLength, suffix) != 0)
+    return -1;
+
+  string number = name.substr(prefixLength, name.length() - prefixLength - suffixLength);
+  if (number.length() > 9 || (number.length() > 1 && number[0] == '0'))
+    return -1;
+  for (size_t i = 0; i < number.length(); i++)
+    if (!isdigit(number[i]))
+      return -1;
+  return atoi(number.c_str());
+}
+
+/**
+ * Finds node of the tree by path relative to the working directory
+ * @return Returns false if there is no such node
+ */
+static bool lookup(const TClient *client, const string &path, TNode *node) {
+  string full = (!path.empty() && path[0] == '/') ? path : client->cwd + "/" + path;
+  vector<string> parts;
+  istringstream components(full);
+  string part;
+  while (getline(components, part, '/')) {
+    if (part.empty() || part == ".")
+      continue;
+    if (part == "..") {
+      if (!parts.empty())
+        parts.pop_back();
+      continue;
+    }
+    parts.push_back(part);
+  }
+
+  node->dir = true;
+  node->level = 0;
+  node->path = "";
+  for (size_t i = 0; i < parts.size(); i++) {
+    int index;
+    if (!node->dir)
+      return false; // file in the middle of the path
+    if (node->level < client->config.depth &&
+        (index = nameIndex(parts[i], "d", "")) != -1 && index < client->config.width) {
+      node->level++;
+    } else if ((index = nameIndex(parts[i], "f", ".dat")) != -1 && index < client->config.files) {
+      node->dir = false;
+    } else {
+      return false;
+    }
+    node->path += "/" + parts[i];
+  }
+  if (node->path.empty())
+    node->path = "/";
+  return true;
+}
+
+/** Generates listing of a directory in the format of LIST, NLST or MLSD */
+static string listing(const TClient *client, const TNode &dir, const string &order) {
+  const TStubConfig &config = client->config;
+  int dirs = dir.level < config.depth ? config.width : 0;
+  string text;
+  char line[256];
+
+  text.reserve((dirs + config.files + 1) * 64);
+  if (order == "MLSD")
+    text += "type=cdir;modify=" STUBMODIFY ";perm=el; .\r\n";
+  for (int i = 0; i < dirs; i++) {
+    if (order == "NLST")
+      snprintf(line, sizeof line, "d%d\r\n", i);
+    else if (order == "MLSD")
+      snprintf(line, sizeof line, "type=dir;modify=" STUBMODIFY ";perm=el; d%d\r\n", i);
+    else
+      snprintf(line, sizeof line, "drwxr-xr-x    2 ftp      ftp          4096 Mar 23 12:00 d%d\r\n", i);
+    text += line;
+  }
+  for (int i = 0; i < config.files; i++) {
+    if (order == "NLST")
+      snprintf(line, sizeof line, "f%d.dat\r\n", i);
+    else if (order == "MLSD")
+      snprintf(line, sizeof line, "type=file;size=%lld;modify=" STUBMODIFY ";perm=r; f%d.dat\r\n",
+               config.fileSize, i);
+    else
+      snprintf(line, sizeof line, "-rw-r--r--    1 ftp      ftp      %10lld Mar 23 12:00 f%d.dat\r\n",
+               config.fileSize, i);
+    text += line;
+  }
+  if (config.hostile) { // names which must not become local file names
+    if (order == "NLST")
+      text += ".\r\n..\r\n../up.dat\r\nd0/in.dat\r\n";
+    else if (order == "MLSD")
+      text += "type=dir;perm=el; .\r\ntype=dir;perm=el; ..\r\n"
+              "type=file;size=1;perm=r; ../up.dat\r\ntype=file;size=1;perm=r; d0/in.dat\r\n";
+    else
+      text += "drwxr-xr-x    2 ftp      ftp          4096 Mar 23 12:00 .\r\n"
+              "drwxr-xr-x    2 ftp      ftp          4096 Mar 23 12:00 ..\r\n"
+              "-rw-r--r--    1 ftp      ftp             1 Mar 23 12:00 ../up.dat\r\n"
+              "-rw-r--r--    1 ftp      ftp             1 Mar 23 12:00 d0/in.dat\r\n";
+  }
+  return text;
+}
+
+/** Facts of a node for MLST */
+static string facts(const TClient *client, const TNode &node) {
+  ostringstream text;
+  if (node.dir)
+    text << "type=dir;modify=" STUBMODIFY ";perm=el; " << node.path;
+  else
+    text << "type=file;size=" << client->config.fileSize << ";modify=" STUBMODIFY ";perm=r; "
+         << node.path;
+  return text.str();
+}
+
+/** Opens listening data socket and answers PASV */
+static bool passive(TClient *client) {
+  if (client->pasvfd != -1)
+    close(client->pasvfd);
+
+  struct sockaddr_in addr;
+  socklen_t length = sizeof addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((client->pasvfd = socket(AF_INET, SOCK_STREAM, 0)) == -1 ||
+      bind(client->pasvfd, (struct sockaddr *)&addr, sizeof addr) == -1 ||
+      ::listen(client->pasvfd, 1) == -1 ||
+      getsockname(client->pasvfd, (struct sockaddr *)&addr, &length) == -1) {
+    if (client->pasvfd != -1)
+      close(client->pasvfd);
+    client->pasvfd = -1;
+    return reply(client, "425 Can't open data connection.");
+  }
+
+  int port = ntohs(addr.sin_port);
+  ostringstream text;
+  text << "227 Entering Passive Mode (127,0,0,1," << port / 256 << "," << port % 256 << ").";
+  return reply(client, text.str());
+}
+
+/**
+ * Accepts the data connection and sends data through it
+ * @param data Data to send, NULL - send content of a file
+ */
+static bool sendData(TClient *client, const string *data) {
+  if (client->pasvfd == -1)
+    return reply(client, "425 Use PASV first.");
+  if (!reply(client, "150 Here comes the data."))
+    return false;
+
+  struct pollfd pfd;
+  pfd.fd = client->pasvfd;
+  pfd.events = POLLIN;
+  int datafd = -1;
+  if (poll(&pfd, 1, STUBACCEPTTIMEOUT) == 1)
+    datafd = accept(client->pasvfd, NULL, NULL);
+  close(client->pasvfd);
+  client->pasvfd = -1;
+  if (datafd == -1)
+    return reply(client, "425 Can't open data connection.");
+
+  bool sent = true;
+  if (data != NULL) {
+    sent = sendAll(datafd, data->data(), data->length());
+  } else { // content is a repeating pattern
+    long long remaining = client->config.fileSize - client->rest;
+    long long offset = client->rest;
+    while (sent && remaining > 0) {
+      size_t start = offset % 26;
+      size_t length = min((long long)(sizeof pattern - start), remaining);
+      sent = sendAll(datafd, pattern + start, length);
+      offset += length;
+      remaining -= length;
+    }
+  }
+  client->rest = 0;
+  close(datafd);
+  return reply(client, sent ? "226 Transfer complete." : "426 Connection closed; transfer aborted.");
+}
+
+/** Handles one command, returns false if the connection is to be closed */
+static bool handle(TClient *client, const string &line) {
+  unsigned long spacePos = line.find(" ");
+  string order = line.substr(0, spacePos);
+  string arg = spacePos == string::npos ? "" : line.substr(spacePos + 1);
+  for (size_t i = 0; i < order.length(); i++)
+    order[i] = toupper(order[i]);
+  TNode node;
+
+  if (order == "USER")
+    return reply(client, "331 Please specify the password.");
+  if (order == "PASS")
+    return reply(client, "230 Login successful.");
+  if (order == "SYST")
+    return reply(client, "215 UNIX Type: L8");
+  if (order == "FEAT")
+    return reply(client, "211-Features:\r\n MDTM\r\n MLST type*;size*;modify*;perm*;\r\n"
+                         " REST STREAM\r\n SIZE\r\n211 End");
+  if (order == "TYPE" || order == "MODE" || order == "NOOP")
+    return reply(client, "200 OK.");
+  if (order == "PWD")
+    return reply(client, "257 \"" + client->cwd + "\" is the current directory");
+  if (order == "CWD" || order == "CDUP") {
+    if (!lookup(client, order == "CDUP" ? ".." : arg, &node) || !node.dir)
+      return reply(client, "550 Failed to change directory.");
+    client->cwd = node.path;
+    return reply(client, "250 Directory successfully changed.");
+  }
+  if (order == "PASV")
+    return passive(client);
+  if (order == "LIST" || order == "NLST" || order == "MLSD") {
+    if (!arg.empty() && arg[0] == '-') // ls options
+      arg = "";
+    if (!lookup(client, arg, &node) || (order == "MLSD" && !node.dir)) {
+      if (client->pasvfd != -1)
+        close(client->pasvfd);
+      client->pasvfd = -1;
+      return reply(client, "550 Failed to open directory.");
+    }
+    string text = node.dir ? listing(client, node, order) : "";
+    return sendData(client, &text);
+  }
+  if (order == "MLST") {
+    if (!lookup(client, arg, &node))
+      return reply(client, "550 No such file or directory.");
+    return reply(client, "250-Listing " + node.path + "\r\n " + facts(client, node) + "\r\n250 End");
+  }
+  if (order == "SIZE" || order == "MDTM") {
+    if (!lookup(client, arg, &node) || (order == "SIZE" && node.dir))
+      return reply(client, "550 Could not get file size.");
+    ostringstream text;
+    text << "213 ";
+    if (order == "SIZE")
+      text << client->config.fileSize;
+    else
+      text << STUBMODIFY;
+    return reply(client, text.str());
+  }
+  if (order == "REST") {
+    client->rest = strtoll(arg.c_str(), NULL, 10);
+    if (client->rest < 0 || client->rest > client->config.fileSize)
+      client->rest = 0;
+    return reply(client, "350 Restart position accepted.");
+  }
+  if (order == "RETR") {
+    if (!lookup(client, arg, &node) || node.dir) {
+      if (client->pasvfd != -1)
+        close(client->pasvfd);
+      client->pasvfd = -1;
+      return reply(client, "550 Failed to open file.");
+    }
+    return sendData(client, NULL);
+  }
+  if (order == "QUIT") {
+    reply(client, "221 Goodbye.");
+    return false;
+  }
+  return reply(client, "502 Command not implemented.");
+}
+
+/** Serves one control connection */
+static void *clientThread(void *data) {
+  TClient *client = (TClient *)data;
+  char buffer[4096];
+  string pending;
+  int flag = 1;
+
+  setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof flag);
+  bool open = reply(client, "220 ftpstub ready.");
+  while (open) {
+    ssize_t received = recv(client->fd, buffer, sizeof buffer, 0);
+    if (received == -1 && errno == EINTR)
+      continue;
+    if (received <= 0)
+      break;
+    pending.append(buffer, received);
+
+    unsigned long newlinePos;
+    while (open && (newlinePos = pending.find("\n")) != string::npos) {
+      string line = pending.substr(0, newlinePos);
+      pending.erase(0, newlinePos + 1);
+      if (!line.empty() && line[line.length() - 1] == '\r')
+        line.erase(line.length() - 1);
+      open = handle(client, line);
+    }
+  }
+
+  if (client->pasvfd != -1)
+    close(client->pasvfd);
+  close(client->fd);
+  delete client;
+  return NULL;
+}
+
+FtpStub::FtpStub(const TStubConfig &config) {
+  this->config = config;
+  for (size_t i = 0; i < sizeof pattern; i++)
+    pattern[i] = 'a' + i % 26;
+  listenfd = -1;
+  listenPort = 0;
+  running = false;
+}
+
+FtpStub::~FtpStub() {
+  stop();
+}
+
+/**
+ * Starts listening on 127.0.0.1
+ * @param port Port number, 0 - any free port
+ * @return Returns the port or -1 on error
+ */
+int FtpStub::listen(int port) {
+  struct sockaddr_in addr;
+  socklen_t length = sizeof addr;
+  int flag = 1;
+
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+    return -1;
+  setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof flag);
+  if (bind(listenfd, (struct sockaddr *)&addr, sizeof addr) == -1 ||
+      ::listen(listenfd, 64) == -1 ||
+      getsockname(listenfd, (struct sockaddr *)&addr, &length) == -1) {
+    close(listenfd);
+    listenfd = -1;
+    return -1;
+  }
+  listenPort = ntohs(addr.sin_port);
+  return listenPort;
+}
+
+/**
+ * Starts listening and serves in a background thread
+ * @return Returns the port or -1 on error
+ */
+int FtpStub::start(int port) {
+  if (listen(port) == -1)
+    return -1;
+  if (pthread_create(&thread, NULL, serveThread, this) != 0) {
+    close(listenfd);
+    listenfd = -1;
+    return -1;
+  }
+  running = true;
+  return listenPort;
+}
+
+void *FtpStub::serveThread(void *stub) {
+  ((FtpStub *)stub)->serve();
+  return NULL;
+}
+
+/** Accepts control connections until stop() is called */
+void FtpStub::serve() {
+  while (true) {
+    int fd = accept(listenfd, NULL, NULL);
+    if (fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      break; // listening socket was shut down
+    }
+
+    TClient *client = new TClient;
+    client->fd = fd;
+    client->config = config;
+    client->cwd = "/";
+    client->pasvfd = -1;
+    client->rest = 0;
+    pthread_t clientThreadId;
+    if (pthread_create(&clientThreadId, NULL, clientThread, client) != 0) {
+      close(fd);
+      delete client;
+      continue;
+    }
+    pthread_detach(clientThreadId);
+  }
+}
+
+/** Stops accepting connections, connections being served are not closed */
+void FtpStub::stop() {
+  if (listenfd == -1)
+    return;
+  shutdown(listenfd, SHUT_RDWR);
+  if (running)
+    pthread_join(thread, NULL);
+  running = false;
+  close(listenfd);
+  listenfd = -1;
+}
@@ -0,0 +1,58 @@
+/**
+  * File:    stub.h
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Simple FTP client for IPP (project 1)
+  *          Stand-in FTP server on the loopback serving a synthetic
+  *          directory tree, used by ftpstub and ftpbench.
+  */
+
+#ifndef STUB_H
+#define STUB_H
+
+#include <string>
+#include <pthread.h>
+
+#define STUBFRAGMENTGAP 200 // us between fragments of one reply
+#define STUBMODIFY "20140323120000" // modify time of every entry
+
+/**
+ * Shape of the synthetic tree and behaviour of the server. Directories
+ * are named d0 .. d<width-1>, files f0.dat .. f<files-1>.dat, every
+ * directory above depth contains both.
+ */
+typedef struct stubConfig {
+  int depth; // levels of directories below the root
+  int width; // subdirectories in each directory
+  int files; // files in each directory
+  long long fileSize; // size of every file
+  int latency; // ms before each reply
+  int fragment; // bytes per segment of a reply, 0 - whole reply at once
+  bool hostile; // listings also contain ., .., ../up.dat and d0/in.dat
+} TStubConfig;
+
+/**
+ * FTP server stand-in. start() listens on 127.0.0.1 and serves in a
+ * background thread, serve() serves in the calling thread. Every control
+ * connection is handled by its own thread.
+ */
+class FtpStub {
+  public:
+    FtpStub(const TStubConfig &config);
+    ~FtpStub();
+    int listen(int port = 0);
+    int start(int port = 0);
+    void serve();
+    void stop();
+    int port() const { return listenPort; }
+  private:
+    static void *serveThread(void *stub);
+    TStubConfig config;
+    int listenfd;
+    int listenPort;
+    bool running; // background thread was started
+    pthread_t thread;
+};
+
+void stubDefaults(TStubConfig *config);
+
+#endif
@@ -0,0 +1,32 @@
+/**
+  * File:    adaptive.h
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: TCP transfer with adaptive block size (client -a).
+  *          IPP project 2, FIT VUTBR
+  *
+  * The client asks by "filename;2\n" instead of "filename;\n". The server
+  * answers "9" if the file could not be opened, otherwise it sends frames
+  *   "8<length><data>"   block, not the last one
+  *   "7<length><data>"   the last block
+  * with length of ADAPT_LENLEN digits. Every frame is acknowledged by "1",
+  * the last one by "2", as in the original protocol.
+  *
+  * The server chooses length of each frame from its rate and the observed
+  * round trip of the acknowledgement: max(rate * ADAPT_INTERVAL,
+  * 2 * rate * RTT) within [ADAPT_MIN, ADAPT_MAX], and sends the frames at
+  * deadlines keeping the average rate. So it wakes up at most once per
+  * ADAPT_INTERVAL whatever the rate is, and waiting for the acknowledgement
+  * does not limit the rate.
+  */
+
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#define ADAPT_REQUEST ";2\n" // end of the request
+#define ADAPT_LENLEN 8 // digits of the frame length
+#define ADAPT_HEADER (1 + ADAPT_LENLEN)
+#define ADAPT_MIN 999 // bytes, the block of the original protocol
+#define ADAPT_MAX (4 * 1024 * 1024) // bytes
+#define ADAPT_INTERVAL 20 // ms between frames at low RTT
+
+#endif
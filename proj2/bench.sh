@@ -0,0 +1,133 @@
+#!/bin/sh
+# File:    bench.sh
+# Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+# Project: Throughput of the file transfer under latency, measured through
+#          relay (delay, jitter, segment splitting) on the loopback.
+#          Then CPU time used per transfer at given server rates, without
+#          relay (clock tick resolution, see getconf CLK_TCK).
+#          IPP project 2, FIT VUTBR
+#          Prints CSV: mode,rtt_ms,jitter_ms,split,block,bytes,seconds,rate_kBps
+#          and CSV: mode,rate_kBps,bytes,blocks,seconds,server_cpu_ms,client_cpu_ms
+#
+# Usage: ./bench.sh
+# Environment (defaults in brackets):
+#   SIZE    size of the transferred file in kB [200]
+#   RTTS    round trip times in ms, split evenly to both directions [0 2 10 50]
+#   JITTER  maximal jitter added in each direction in ms [0]
+#   SPLITS  sizes the relay splits segments to, 0 - unchanged [0 536],
+#           not used by the udp mode
+#   LOSS    percentage of blocks dropped by the client in udp mode [0]
+#   MODES   protocol modes to measure [tcp adaptive udp]
+#   PORT    first of three ports used by servers and relay [9960]
+#   CPU_RATES    server rates of the CPU measurement in kB/s, "" - none
+#                [100 1000 10000 100000]
+#   CPU_SECONDS  intended duration of one transfer of the CPU measurement [1]
+
+set -e
+cd "$(dirname "$0")"
+make -s client server relay
+
+SIZE=${SIZE:-200}
+RTTS=${RTTS:-"0 2 10 50"}
+JITTER=${JITTER:-0}
+SPLITS=${SPLITS:-"0 536"}
+LOSS=${LOSS:-0}
+MODES=${MODES:-"tcp adaptive udp"}
+PORT=${PORT:-9960}
+RELAY_PORT=$((PORT + 1))
+CPU_PORT=$((PORT + 2))
+CPU_RATES=${CPU_RATES-"100 1000 10000 100000"}
+CPU_SECONDS=${CPU_SECONDS:-1}
+TICK=$(getconf CLK_TCK)
+
+bin=$(pwd)
+work=$(mktemp -d)
+server_pid=
+relay_pid=
+cpu_pid=
+trap 'kill $server_pid $relay_pid $cpu_pid 2>/dev/null; rm -rf "$work"' EXIT INT TERM
+
+head -c $((SIZE * 1000)) /dev/urandom > "$work/data.bin"
+(cd "$work" && exec "$bin/server" -p $PORT -d 1000000 -u) &
+server_pid=$!
+
+# Returns number value of given key from the summary
+summary() {
+  sed "s/.*\"$1\":\([0-9]*\).*/\1/" "$work/summary.json"
+}
+
+# Prints CPU time of finished children of given process in clock ticks
+children_cpu() {
+  awk '{ print $16 + $17 }' /proc/$1/stat
+}
+
+# Runs client in given mode against given port and file, prints payload bytes per block
+run_client() {
+  case $1 in
+    tcp)
+      "$bin/client" -s "$work/summary.json" -o "$work/out.bin" 127.0.0.1:$2/$3
+      echo 999 ;;
+    adaptive)
+      "$bin/client" -a -s "$work/summary.json" -o "$work/out.bin" 127.0.0.1:$2/$3
+      echo $(($(summary bytes) / $(summary blocks))) ;;
+    udp)
+      "$bin/client" -u -L $LOSS -s "$work/summary.json" -o "$work/out.bin" 127.0.0.1:$2/$3
+      echo 999 ;;
+    *)
+      echo "Unknown mode $1" >&2
+      return 1 ;;
+  esac
+}
+
+echo "mode,rtt_ms,jitter_ms,split,block,bytes,seconds,rate_kBps"
+for mode in $MODES; do
+  for rtt in $RTTS; do
+    splits=$SPLITS
+    relay_mode=
+    if [ $mode = udp ]; then
+      splits=0
+      relay_mode=-u
+    fi
+    for split in $splits; do
+      "$bin/relay" $relay_mode -l $RELAY_PORT -t 127.0.0.1:$PORT -d $((rtt / 2)) -j $JITTER -s $split &
+      relay_pid=$!
+      sleep 0.2
+
+      block=$(run_client $mode $RELAY_PORT data.bin)
+      cmp -s "$work/data.bin" "$work/out.bin" || echo "$mode: received file differs" >&2
+      us=$(summary total_us)
+      bytes=$(summary bytes)
+      awk -v m=$mode -v r=$rtt -v j=$JITTER -v s=$split -v b=$block -v n=$bytes -v us=$us \
+        'BEGIN { printf "%s,%d,%d,%d,%d,%d,%.3f,%.1f\n", m, r, j, s, b, n, us / 1E6, n / us * 1E3 }'
+
+      kill $relay_pid 2>/dev/null
+      wait $relay_pid 2>/dev/null || true
+      relay_pid=
+    done
+  done
+done
+
+[ -n "$CPU_RATES" ] || exit 0
+echo
+echo "mode,rate_kBps,bytes,blocks,seconds,server_cpu_ms,client_cpu_ms"
+for rate in $CPU_RATES; do
+  truncate -s $((rate * 1000 * CPU_SECONDS)) "$work/cpu.bin"
+  (cd "$work" && exec "$bin/server" -p $CPU_PORT -d $rate -u) &
+  cpu_pid=$!
+  sleep 0.2
+  for mode in $MODES; do
+    server_before=$(children_cpu $cpu_pid)
+    client_before=$(children_cpu $$)
+    run_client $mode $CPU_PORT cpu.bin > /dev/null
+    sleep 0.1 # server reaps the child
+    server_cpu=$(($(children_cpu $cpu_pid) - server_before))
+    client_cpu=$(($(children_cpu $$) - client_before))
+    cmp -s "$work/cpu.bin" "$work/out.bin" || echo "$mode: received file differs" >&2
+    awk -v m=$mode -v r=$rate -v n=$(summary bytes) -v b=$(summary blocks) -v us=$(summary total_us) \
+        -v s=$server_cpu -v c=$client_cpu -v t=$TICK \
+      'BEGIN { printf "%s,%d,%d,%d,%.3f,%d,%d\n", m, r, n, b, us / 1E6, s * 1000 / t, c * 1000 / t }'
+  done
+  kill $cpu_pid 2>/dev/null
+  wait $cpu_pid 2>/dev/null || true
+  cpu_pid=
+done
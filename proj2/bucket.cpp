@@ -0,0 +1,145 @@
+/**
+  * File:    bucket.cpp
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Receive rate limit shared by clients (client -r rate).
+  *          IPP project 2, FIT VUTBR
+  */
+
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "bucket.h"
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+using namespace std;
+
+/** Returns monotonic time in nanoseconds */
+static long long bucket_now(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/** Reads id of the current boot, empty if it is not known */
+static void read_boot_id(char *boot){
+  memset(boot, 0, BUCKET_BOOTLEN);
+  int fd;
+  if ((fd = ::open(BUCKET_BOOT_ID, O_RDONLY)) == -1)
+    return;
+  ssize_t length = read(fd, boot, BUCKET_BOOTLEN - 1);
+  close(fd);
+  if (length <= 0)
+    boot[0] = '\0';
+  else if (boot[length - 1] == '\n')
+    boot[length - 1] = '\0';
+}
+
+/** Locks the bucket, takes over the lock of a client which died holding it */
+static void lock_bucket(SharedBucket *bucket){
+  if (pthread_mutex_lock(&bucket->lock) == EOWNERDEAD)
+    pthread_mutex_consistent(&bucket->lock);
+}
+
+/**
+ * Returns default file of the bucket, $XDG_RUNTIME_DIR/ipk-client.rate
+ * (the directory belongs to the user) or /tmp/ipk-client-<uid>.rate
+ */
+string bucket_path(){
+  const char *runtime = getenv("XDG_RUNTIME_DIR");
+  if (runtime != NULL && runtime[0] == '/')
+    return string(runtime) + "/" BUCKET_NAME ".rate";
+  ostringstream path;
+  path << "/tmp/" BUCKET_NAME "-" << getuid() << ".rate";
+  return path.str();
+}
+
+RateLimit::~RateLimit(){
+  if (bucket != NULL)
+    munmap(bucket, sizeof(SharedBucket));
+}
+
+/**
+ * Maps the shared bucket, creates it if it does not exist yet, and sets
+ * its rate. The file is locked while it is being initialized.
+ * @param rate kB/s
+ * @return false if the file could not be opened or mapped, or it is not
+ *         a regular file of the user
+ */
+bool RateLimit::open(const string &path, unsigned long rate){
+  int fd;
+  if ((fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW, 0600)) == -1)
+    return false;
+  struct stat info;
+  if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode) || info.st_uid != getuid() ||
+      flock(fd, LOCK_EX) == -1 ||
+      (info.st_size < (off_t)sizeof(SharedBucket) && ftruncate(fd, sizeof(SharedBucket)) == -1)){
+    close(fd);
+    return false;
+  }
+  void *memory = mmap(NULL, sizeof(SharedBucket), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (memory == MAP_FAILED){
+    close(fd);
+    return false;
+  }
+  bucket = static_cast<SharedBucket *>(memory);
+
+  char boot[BUCKET_BOOTLEN];
+  read_boot_id(boot);
+  if (bucket->magic != BUCKET_MAGIC || memcmp(bucket->boot, boot, BUCKET_BOOTLEN) != 0){
+    // new file zeroed by ftruncate, or left from another boot
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&bucket->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    bucket->tokens = 0;
+    bucket->updated = bucket_now();
+    memcpy(bucket->boot, boot, BUCKET_BOOTLEN);
+    bucket->magic = BUCKET_MAGIC;
+  }
+  flock(fd, LOCK_UN);
+  close(fd); // the mapping stays
+
+  lock_bucket(bucket);
+  bucket->rate = rate * 1000.0;
+  pthread_mutex_unlock(&bucket->lock);
+  return true;
+}
+
+/**
+ * Takes tokens for received bytes, waits until the debt they make is paid
+ * by the rate
+ */
+void RateLimit::take(size_t bytes){
+  if (bucket == NULL)
+    return;
+
+  lock_bucket(bucket);
+  long long now = bucket_now();
+  double burst = bucket->rate * BUCKET_BURST / 1E3;
+  if (now > bucket->updated){
+    bucket->tokens = MIN(burst, bucket->tokens + (now - bucket->updated) * bucket->rate / 1E9);
+    bucket->updated = now;
+  }else if (now < bucket->updated){ // time of another clock, the debt would never be paid
+    bucket->tokens = 0;
+    bucket->updated = now;
+  }
+  bucket->tokens -= bytes;
+  long long wait = bucket->tokens < 0 ? (long long)(-bucket->tokens / bucket->rate * 1E9) : 0;
+  pthread_mutex_unlock(&bucket->lock);
+
+  struct timespec ts = {(time_t)(wait / 1000000000), (long)(wait % 1000000000)};
+  while (wait > 0 && clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR)
+    ;
+}
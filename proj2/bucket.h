@@ -0,0 +1,55 @@
+/**
+  * File:    bucket.h
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Receive rate limit shared by clients (client -r rate).
+  *          IPP project 2, FIT VUTBR
+  *
+  * All clients using the same file share one token bucket kept in the file
+  * mapped to their memory and guarded by a process-shared mutex. A client
+  * takes tokens for received data before it acknowledges or reads more,
+  * tokens are refilled by the rate on the monotonic clock. Taking more
+  * than there is leaves a debt the next taker waits for, so the aggregate
+  * rate does not exceed the rate by more than BUCKET_BURST. The monotonic
+  * time is valid only within one boot, the file is initialized again when
+  * it was written during another one. The file is per user, a file owned
+  * by another user or a symbolic link is refused.
+  */
+
+#ifndef BUCKET_H
+#define BUCKET_H
+
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+#include <pthread.h>
+
+#define BUCKET_NAME "ipk-client" // default file shared by clients of the user, see bucket_path
+#define BUCKET_MAGIC 0x4b504953 // the file is initialized
+#define BUCKET_BOOT_ID "/proc/sys/kernel/random/boot_id"
+#define BUCKET_BOOTLEN 40 // stored length of the boot id
+#define BUCKET_BURST 10 // ms of the rate which may come at once after idle time
+
+/** Token bucket in the shared file */
+struct SharedBucket {
+  uint32_t magic;
+  char boot[BUCKET_BOOTLEN]; // boot which the monotonic time belongs to
+  pthread_mutex_t lock;
+  double rate; // bytes per second, set by the last client started
+  double tokens; // bytes, negative - debt
+  long long updated; // last refill, monotonic ns
+};
+
+std::string bucket_path();
+
+/** Receive rate limit, does nothing unless opened */
+class RateLimit {
+  public:
+    RateLimit() : bucket(NULL) {}
+    ~RateLimit();
+    bool open(const std::string &path, unsigned long rate);
+    void take(size_t bytes);
+  private:
+    SharedBucket *bucket;
+};
+
+#endif
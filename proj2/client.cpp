@@ -10,6 +10,7 @@
 #include <sstream>
 #include <string>
 #include <cstring>
+#include <cstdio>
 #include <unistd.h>
 #include <netdb.h>
 #include <arpa/inet.h>
@@ -19,9 +20,22 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <ctime>
+#include <vector>
+#include <poll.h>
+
+#include "../common/connector.h"
+#include "udp.h"
+#include "adaptive.h"
+#include "bucket.h"
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define BUFFSIZE 1000
+#define OUTBUFFSIZE (64 * 1024) // received data are written in chunks of this size
+#define TRACE_RING 1024 // number of block records kept before flushing the trace
+#define HIST_BUCKETS 32 // log2 histogram buckets in microseconds
 
 using namespace std;
 
@@ -37,6 +51,9 @@ enum {
   FOPEN,
   EFILE,
   EPROTOCOL,
+  EWRITE,
+  ESEEK, // output of UDP transfer is not seekable
+  ERATE, // shared rate limit
   EUNKNOWN // Unknown error
 };
 
@@ -52,6 +69,9 @@ const char *ECODEMSG[] = {
   "File for writing couldn't be opened",
   "Requested file could not be opened at server",
   "Received message does not match the protocol",
+  "Failed to write received data",
+  "UDP transfer needs a seekable output",
+  "Shared rate limit could not be opened",
   "Unknown error"
 };
 
@@ -93,16 +113,32 @@ int get_positive_number(const string &str){
 
 /**
  * Class for holding data from given parameters
+ * Received data are collected in an output buffer and written
+ * to the output descriptor (file, stdout or given fd) in large chunks.
  */
 class Params{ 
   public: 
     Params(int argc, char *argv[]); 
     void open_file();
-    void write_file(string buffer);
+    int write_file(const char *data, size_t length);
+    int write_at(const char *data, size_t length, off_t offset);
+    bool seekable() const { return lseek(fd, 0, SEEK_CUR) != -1; }
+    int flush_file();
     void close_file();
     string host, port, filename;
+    string output; // "" - file named after the remote path, "-" - stdout, "fd:N"
+    string summary; // file for JSON transfer summary, "-" - stderr
+    string trace; // file for per-block trace (JSON lines)
+    bool udp; // UDP transport
+    bool adaptive; // TCP frames of length chosen by the server
+    int loss; // percentage of received UDP blocks dropped on purpose
+    unsigned long rate; // receive rate shared by clients in kB/s, 0 - not limited
+    string rate_file; // file with the shared token bucket
   private: 
-    FILE * file;
+    int fd;
+    bool own_fd; // fd was opened by us and is to be closed
+    char *out_buffer;
+    size_t out_length;
 };
 
 /**
@@ -111,10 +147,57 @@ class Params{
  * @param argv Parameters
  */
 Params::Params(int argc, char *argv[]){
-  if (argc != 2) // host:port/soubor
+  fd = -1;
+  own_fd = false;
+  out_buffer = NULL;
+  out_length = 0;
+  udp = false;
+  adaptive = false;
+  loss = 0;
+  rate = 0;
+  rate_file = bucket_path();
+
+  // [-a | -u [-L loss]] [-r rate [-R rate_file]] [-o output] [-s summary] [-T trace]
+  // host:port/soubor
+  if (argc < 2)
     error_exit(EPARAMNUM);
 
-  string param_str = argv[1];
+  int i;
+  for (i = 1; i < argc - 1; i++){
+    if (strcmp(argv[i], "-u") == 0){
+      udp = true;
+      continue;
+    }
+    if (strcmp(argv[i], "-a") == 0){
+      adaptive = true;
+      continue;
+    }
+    if (i + 1 == argc - 1) // option without value or missing host:port/soubor
+      error_exit(EPARAMNUM);
+    string value = argv[++i];
+    if (value.empty())
+      error_exit(EPARAM);
+
+    if (strcmp(argv[i - 1], "-o") == 0)
+      output = value;
+    else if (strcmp(argv[i - 1], "-s") == 0)
+      summary = value;
+    else if (strcmp(argv[i - 1], "-T") == 0)
+      trace = value;
+    else if (strcmp(argv[i - 1], "-r") == 0 && get_positive_number(value) > 0)
+      rate = get_positive_number(value);
+    else if (strcmp(argv[i - 1], "-R") == 0)
+      rate_file = value;
+    else if (strcmp(argv[i - 1], "-L") == 0 && value.length() <= 3 &&
+             value.find_first_not_of("0123456789") == string::npos && atoi(value.c_str()) < 100)
+      loss = atoi(value.c_str());
+    else
+      error_exit(EPARAM);
+  }
+  if ((loss && !udp) || (adaptive && udp) || (rate && udp)) // UDP is paced by the server only
+    error_exit(EPARAM);
+
+  string param_str = argv[argc - 1];
 
   if (param_str.length() == 0)
     error_exit(EPARAM);
@@ -127,7 +210,6 @@ Params::Params(int argc, char *argv[]){
       port = param_str.substr(end_host + 1, end_port - end_host - 1);
       if (get_positive_number(port) != 0 && param_str.length() > (end_port + 1)){
         filename = param_str.substr(end_port + 1);       
-        open_file();
         return;
       }
     }
@@ -136,63 +218,350 @@ Params::Params(int argc, char *argv[]){
  error_exit(EPARAM);
 }
 
+/**
+ * Opens output - file named after the remote path, stdout or given fd.
+ * A file is truncated, so everything which may fail is to be opened first.
+ */
 void Params::open_file(){
-  if ((file = fopen(filename.c_str(), "wb")) == NULL)
-    error_exit(FOPEN);
+  if (output == "-"){
+    fd = STDOUT_FILENO;
+  }else if (output.compare(0, 3, "fd:") == 0){
+    fd = get_positive_number(output.substr(3));
+    if (fd <= 0 || fcntl(fd, F_GETFD) == -1)
+      error_exit(EPARAM);
+  }else{
+    string path = output.empty() ? filename : output;
+    if ((fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+      error_exit(FOPEN);
+    own_fd = true;
+  }
+
+  if ((out_buffer = (char *)malloc(OUTBUFFSIZE)) == NULL)
+    error_exit(EUNKNOWN);
 }
 
+/** Flushes buffered data and closes output if it was opened by us */
 void Params::close_file(){
-  fclose(file);
+  flush_file();
+  free(out_buffer);
+  out_buffer = NULL;
+  if (own_fd)
+    close(fd);
+  fd = -1;
 }
 
-void Params::write_file(string buffer){
-  fwrite(buffer.c_str(), sizeof(const char), buffer.length(),file);
+/** Writes whole buffer to the output, blocks while the consumer is slow */
+static int write_all(int fd, const char *data, size_t length){
+  while (length > 0){
+    ssize_t written = write(fd, data, length);
+    if (written == -1){
+      if (errno == EINTR)
+        continue;
+      return EWRITE;
+    }
+    data += written;
+    length -= written;
+  }
+  return EOK;
 }
 
-/** Connects to server, returns descriptor */
-int connect(Params params, int *fd){ 
-  int socketfd;
-  struct addrinfo setting;
-  struct addrinfo *list;
-  struct addrinfo *ptr;
+/** Writes data at given offset of the output (UDP blocks come out of order) */
+int Params::write_at(const char *data, size_t length, off_t offset){
+  while (length > 0){
+    ssize_t written = pwrite(fd, data, length, offset);
+    if (written == -1){
+      if (errno == EINTR)
+        continue;
+      return EWRITE;
+    }
+    data += written;
+    length -= written;
+    offset += written;
+  }
+  return EOK;
+}
 
-  memset(&setting, 0, sizeof setting); // make the struct empty
-  setting.ai_family = AF_INET;
-  setting.ai_socktype = SOCK_STREAM; 
-  if (getaddrinfo(params.host.c_str(), params.port.c_str(), &setting, &list) != 0) {
-    return EHOST;
+/** Writes buffered data to the output */
+int Params::flush_file(){
+  if (out_length == 0)
+    return EOK;
+  int stat = write_all(fd, out_buffer, out_length);
+  out_length = 0;
+  return stat;
+}
+
+/**
+ * Buffers received data, the buffer is written out when full.
+ * Write blocks until the consumer takes data, so acknowledgement
+ * is not sent earlier and memory usage stays bounded.
+ */
+int Params::write_file(const char *data, size_t length){
+  int stat;
+  if (out_length + length > OUTBUFFSIZE){
+    if ((stat = flush_file()) != EOK)
+      return stat;
+    if (length >= OUTBUFFSIZE) // too big to be buffered
+      return write_all(fd, data, length);
   }
+  memcpy(out_buffer + out_length, data, length);
+  out_length += length;
+  return EOK;
+}
 
-  for (ptr = list; ptr != NULL; ptr = ptr->ai_next) {
-    if ((socketfd = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol)) == -1)
-      continue;
+/** Returns monotonic time in nanoseconds */
+static long long now_ns(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
-    if (connect(socketfd, ptr->ai_addr, ptr->ai_addrlen) == -1) {
-      close(socketfd);
-      continue;
+/** Timestamps of one received block (monotonic, ns) */
+struct BlockRecord {
+  unsigned long seq;
+  unsigned long bytes;
+  long long wait; // started waiting for the block (previous ack sent)
+  long long received; // whole block received
+  long long written; // block passed to the output
+  long long acked; // acknowledgement sent
+};
+
+/** Log2 histogram of durations in microseconds */
+class Histogram{
+  public:
+    Histogram();
+    void add(long long ns);
+    void print(ostream &out) const;
+  private:
+    unsigned long count;
+    long long min, max, sum; // ns
+    unsigned long buckets[HIST_BUCKETS];
+};
+
+Histogram::Histogram(){
+  count = 0;
+  min = max = sum = 0;
+  memset(buckets, 0, sizeof buckets);
+}
+
+void Histogram::add(long long ns){
+  if (count == 0 || ns < min)
+    min = ns;
+  if (ns > max)
+    max = ns;
+  sum += ns;
+  count++;
+
+  long long us = ns / 1000;
+  int bucket = 0;
+  while (us > 1 && bucket < HIST_BUCKETS - 1){
+    us >>= 1;
+    bucket++;
+  }
+  buckets[bucket]++;
+}
+
+/** Prints histogram as JSON object, bucket i counts durations < 2^(i+1) us */
+void Histogram::print(ostream &out) const{
+  out << "{\"count\":" << count
+      << ",\"min_us\":" << min / 1000
+      << ",\"max_us\":" << max / 1000
+      << ",\"mean_us\":" << (count ? sum / count / 1000 : 0)
+      << ",\"log2_us\":[";
+  int last = HIST_BUCKETS - 1;
+  while (last > 0 && buckets[last] == 0)
+    last--;
+  for (int i = 0; i <= last; i++)
+    out << (i ? "," : "") << buckets[i];
+  out << "]}";
+}
+
+/**
+ * Transfer timeline - records phases of the transfer and timing of each
+ * block. Summary statistics are updated per block, block records are kept
+ * in a preallocated ring which is flushed to the trace file when full.
+ */
+class Timeline{
+  public:
+    Timeline(const string &summary, const string &trace);
+    ~Timeline();
+    bool enabled() const { return on; }
+    void mark_start() { if (on) start = now_ns(); }
+    void mark_resolved(long long when) { if (on) resolved = when; }
+    void mark_connected() { if (on) connected = now_ns(); }
+    void mark_requested() { if (on) requested = now_ns(); }
+    void mark_end() { if (on) end = now_ns(); }
+    void add_block(const BlockRecord &record);
+    void set_udp(unsigned long nacks, unsigned long duplicates, unsigned long dropped);
+    void report(const Params &params, int stat);
+  private:
+    void flush_trace();
+    bool on;
+    string summary_path;
+    ofstream trace_file;
+    BlockRecord *ring;
+    unsigned ring_length;
+    long long start, resolved, connected, requested, first_block, last_ack;
+    long long end; // end of the transfer, 0 - when reported
+    unsigned long blocks, bytes;
+    unsigned long nacks, duplicates, dropped; // UDP transfer
+    Histogram gap, write, ack;
+};
+
+Timeline::Timeline(const string &summary, const string &trace){
+  on = !summary.empty() || !trace.empty();
+  summary_path = summary;
+  ring = NULL;
+  ring_length = 0;
+  start = resolved = connected = requested = first_block = last_ack = end = 0;
+  blocks = bytes = 0;
+  nacks = duplicates = dropped = 0;
+  if (!trace.empty()){
+    trace_file.open(trace.c_str());
+    if (!trace_file)
+      error_exit(FOPEN);
+    ring = new BlockRecord[TRACE_RING];
+  }
+}
+
+Timeline::~Timeline(){
+  delete[] ring;
+}
+
+void Timeline::add_block(const BlockRecord &record){
+  if (blocks == 0)
+    first_block = record.received;
+  blocks++;
+  bytes += record.bytes;
+  last_ack = record.acked;
+  gap.add(record.received - record.wait);
+  write.add(record.written - record.received);
+  ack.add(record.acked - record.written);
+
+  if (ring == NULL)
+    return;
+  ring[ring_length++] = record;
+  if (ring_length == TRACE_RING)
+    flush_trace();
+}
+
+/** Records statistics of UDP transfer */
+void Timeline::set_udp(unsigned long nacks, unsigned long duplicates, unsigned long dropped){
+  this->nacks = nacks;
+  this->duplicates = duplicates;
+  this->dropped = dropped;
+}
+
+/** Writes block records from the ring to the trace file, times relative to start */
+void Timeline::flush_trace(){
+  for (unsigned i = 0; i < ring_length; i++){
+    const BlockRecord &r = ring[i];
+    trace_file << "{\"seq\":" << r.seq
+               << ",\"bytes\":" << r.bytes
+               << ",\"wait_us\":" << (r.wait - start) / 1000
+               << ",\"received_us\":" << (r.received - start) / 1000
+               << ",\"written_us\":" << (r.written - start) / 1000
+               << ",\"acked_us\":" << (r.acked - start) / 1000 << "}\n";
+  }
+  ring_length = 0;
+}
+
+/** Returns string as JSON string literal */
+static string json_string(const string &str){
+  string json = "\"";
+  for (size_t i = 0; i < str.length(); i++){
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\'){
+      json += '\\';
+      json += c;
+    }else if (c < 0x20){
+      char escaped[8];
+      snprintf(escaped, sizeof escaped, "\\u%04x", c);
+      json += escaped;
+    }else{
+      json += c;
     }
-    break;
   }
+  return json + "\"";
+}
 
-  if (ptr == NULL) {
-    close(socketfd);
-    return ECONNECTION;
+/** Flushes the trace and prints JSON summary of the transfer */
+void Timeline::report(const Params &params, int stat){
+  if (!on)
+    return;
+  if (ring != NULL){
+    flush_trace();
+    trace_file.close();
   }
-    
-  freeaddrinfo(list);
+  if (summary_path.empty())
+    return;
+
+  ofstream file;
+  if (summary_path != "-"){
+    file.open(summary_path.c_str());
+    if (!file)
+      return;
+  }
+  ostream &out = summary_path == "-" ? cerr : file;
+
+  long long total = (end ? end : now_ns()) - start;
+  out << "{\"host\":" << json_string(params.host) << ",\"port\":" << json_string(params.port)
+      << ",\"file\":" << json_string(params.filename)
+      << ",\"status\":" << stat
+      << ",\"bytes\":" << bytes
+      << ",\"blocks\":" << blocks
+      << ",\"dns_us\":" << (resolved ? (resolved - start) / 1000 : -1)
+      << ",\"connect_us\":" << (connected ? (connected - resolved) / 1000 : -1)
+      << ",\"first_block_us\":" << (blocks ? (first_block - requested) / 1000 : -1)
+      << ",\"total_us\":" << total / 1000
+      << ",\"rate_Bps\":" << (total ? (long long)(bytes * 1E9 / total) : 0);
+  if (params.adaptive)
+    out << ",\"transport\":\"adaptive\"";
+  if (params.udp)
+    out << ",\"transport\":\"udp\",\"nacks\":" << nacks << ",\"duplicates\":" << duplicates
+        << ",\"dropped\":" << dropped;
+  out << ",\"gap\":";
+  gap.print(out);
+  out << ",\"write\":";
+  write.print(out);
+  out << ",\"ack\":";
+  ack.print(out);
+  out << "}" << endl;
+}
+
+/** Connects to server, returns descriptor */
+int connect(Params &params, int *fd, Timeline &timeline){ 
+  long long resolved;
+
+  timeline.mark_start();
+  switch (raceConnect(params.host, params.port, AF_UNSPEC, CONNECT_TIMEOUT, fd, &resolved)) {
+    case CONNECT_OK:
+      break;
+    case CONNECT_EHOST:
+      return EHOST;
+    default:
+      return ECONNECTION;
+  }
+  timeline.mark_resolved(resolved);
+  timeline.mark_connected();
 
-  *fd = socketfd;
   return EOK;
 }
 
 
-/** Receives file by filename form params through socketfd */
-int receive_file(Params params, int socketfd){
+/**
+ * Receives file by filename form params through socketfd
+ * Acknowledgement of each block waits for the rate limit.
+ */
+int receive_file(Params &params, int socketfd, Timeline &timeline, RateLimit &limit){
 
   char buffer[BUFFSIZE + 1];
   string send_msg;
   long int num_read;
+  BlockRecord record;
+  record.seq = 0;
   while (1){
+    if (timeline.enabled())
+      record.wait = now_ns();
     memset(&buffer, 0, sizeof buffer); // make the buffer empty
     if ((num_read = recv(socketfd, buffer, BUFFSIZE, 0)) == -1) {
        return ERECV;
@@ -209,13 +578,26 @@ int receive_file(Params params, int socketfd){
         recv_msg += a;
       }
       // obdrzen cely paket, zapis do souboru:
+      if (timeline.enabled())
+        record.received = now_ns();
  
-      params.write_file(recv_msg.substr(1)); //all apart from the first char "8"
+      //all apart from the first char "8"
+      if (params.write_file(recv_msg.data() + 1, recv_msg.length() - 1) != EOK)
+        return EWRITE;
+      if (timeline.enabled())
+        record.written = now_ns();
+      limit.take(recv_msg.length() - 1);
       
       // Acknowledge.
       send_msg = "1"; // got it, expecting more 
       if (send(socketfd, send_msg.c_str(), send_msg.length(), 0) == -1)
         return ESEND;
+      if (timeline.enabled()){
+        record.acked = now_ns();
+        record.bytes = recv_msg.length() - 1;
+        timeline.add_block(record);
+        record.seq++;
+      }
     }else if (!strcmp(recv_msg.substr(0, 1).c_str(), "7")){ // read file, last
       while (recv_msg.length() < 4){ // If received less than 4 characters,
                                      // not very probable.
@@ -238,12 +620,26 @@ int receive_file(Params params, int socketfd){
         recv_msg += a;
       }
       // received all packet, write to file
-      params.write_file(recv_msg.substr(4)); //without protocol code (4 chars)
+      if (timeline.enabled())
+        record.received = now_ns();
+      //without protocol code (4 chars)
+      if (params.write_file(recv_msg.data() + 4, recv_msg.length() - 4) != EOK)
+        return EWRITE;
+      if (params.flush_file() != EOK)
+        return EWRITE;
+      if (timeline.enabled())
+        record.written = now_ns();
+      limit.take(recv_msg.length() - 4);
 
       // Acknowledge.
       send_msg = "2"; // got it, received all file 
       if (send(socketfd, send_msg.c_str(), send_msg.length(), 0) == -1)
         return ESEND;
+      if (timeline.enabled()){
+        record.acked = now_ns();
+        record.bytes = recv_msg.length() - 4;
+        timeline.add_block(record);
+      }
       return EOK;
     }else{
       return EPROTOCOL;
@@ -253,31 +649,336 @@ int receive_file(Params params, int socketfd){
 
 }
 
+/** Receives exactly length bytes, returns false if the connection failed */
+static bool recv_all(int socketfd, char *data, size_t length){
+  while (length > 0){
+    ssize_t received = recv(socketfd, data, length, 0);
+    if (received == -1 && errno == EINTR)
+      continue;
+    if (received <= 0)
+      return false;
+    data += received;
+    length -= received;
+  }
+  return true;
+}
+
+/**
+ * Receives file in frames of adaptive length (adaptive.h), data of a frame
+ * are passed to the output as they come. Each chunk is read when the rate
+ * limit allows it, so a large frame is slowed down by TCP flow control.
+ */
+int receive_frames(Params &params, int socketfd, Timeline &timeline, RateLimit &limit){
+  char buffer[OUTBUFFSIZE];
+  BlockRecord record;
+  record.seq = 0;
+  bool last = false;
+
+  while (!last){
+    if (timeline.enabled())
+      record.wait = now_ns();
+    char header[ADAPT_HEADER + 1];
+    if (!recv_all(socketfd, header, 1))
+      return ERECV;
+    if (header[0] == '9')
+      return EFILE;
+    if (header[0] != '8' && header[0] != '7')
+      return EPROTOCOL;
+    last = header[0] == '7';
+    if (!recv_all(socketfd, header + 1, ADAPT_LENLEN))
+      return ERECV;
+    header[ADAPT_HEADER] = '\0';
+    char *end;
+    unsigned long length = strtoul(header + 1, &end, 10);
+    if (*end != '\0' || length > ADAPT_MAX)
+      return EPROTOCOL;
+
+    for (unsigned long left = length; left > 0; ){
+      size_t chunk = MIN(left, sizeof buffer);
+      limit.take(chunk);
+      if (!recv_all(socketfd, buffer, chunk))
+        return ERECV;
+      if (params.write_file(buffer, chunk) != EOK)
+        return EWRITE;
+      left -= chunk;
+    }
+    if (timeline.enabled())
+      record.received = now_ns();
+    if (last && params.flush_file() != EOK)
+      return EWRITE;
+    if (timeline.enabled())
+      record.written = now_ns();
+
+    if (send(socketfd, last ? "2" : "1", 1, 0) == -1) // got it, expecting more or done
+      return ESEND;
+    if (timeline.enabled()){
+      record.acked = now_ns();
+      record.bytes = length;
+      timeline.add_block(record);
+      record.seq++;
+    }
+  }
+  return EOK;
+}
+
+/**
+ * Builds NACK of blocks missing in [first, last] which were not reported
+ * during the last interval, returns empty string if there is none
+ */
+static string build_nack(const vector<bool> &received, vector<long long> &nacked,
+                         unsigned long first, unsigned long last, long long now, long long interval){
+  ostringstream nack;
+  bool any = false;
+  nack << "N";
+  for (unsigned long seq = first; seq <= last && seq < received.size(); seq++){
+    if (received[seq] || now - nacked[seq] < interval)
+      continue;
+    if ((long)nack.tellp() > UDP_DATAGRAM - 2 * (UDP_SEQLEN + 1))
+      break; // the rest next time
+    unsigned long end = seq;
+    while (end + 1 <= last && end + 1 < received.size() &&
+           !received[end + 1] && now - nacked[end + 1] >= interval)
+      end++;
+    for (unsigned long i = seq; i <= end; i++)
+      nacked[i] = now;
+    nack << (any ? "," : "") << seq << "-" << end;
+    any = true;
+    seq = end;
+  }
+  return any ? nack.str() : "";
+}
+
+/**
+ * Receives file over UDP. Blocks are written at their offsets as they
+ * come, gaps are reported by NACKs right away and again every interval
+ * (2 RTT) until the retransmitted blocks arrive.
+ */
+int receive_file_udp(Params &params, Timeline &timeline){
+  if (!params.seekable())
+    return ESEEK;
+
+  struct addrinfo setting;
+  struct addrinfo *list;
+  memset(&setting, 0, sizeof setting); // make the struct empty
+  setting.ai_family = AF_INET; // the UDP socket of the server is IPv4 only
+  setting.ai_socktype = SOCK_DGRAM;
+  timeline.mark_start();
+  if (getaddrinfo(params.host.c_str(), params.port.c_str(), &setting, &list) != 0)
+    return EHOST;
+  timeline.mark_resolved(now_ns());
+
+  int sockfd;
+  if ((sockfd = socket(list->ai_family, list->ai_socktype, list->ai_protocol)) == -1){
+    freeaddrinfo(list);
+    return ECONNECTION;
+  }
+  int rcvbuf = UDP_RCVBUF; // blocks come paced by the server only
+  setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+
+  // request, repeated until the server answers from the port of the transfer
+  string request = params.filename + ";\n";
+  char msg[UDP_DATAGRAM + 1];
+  ssize_t length = 0;
+  struct sockaddr_storage from;
+  socklen_t from_size;
+  long long sent_at = 0;
+  long long deadline = now_ns() + UDP_TIMEOUT * 1000000LL;
+  timeline.mark_requested();
+  while (length <= 0 || (msg[0] != '5' && msg[0] != '9')){
+    long long now = now_ns();
+    if (now > deadline){
+      freeaddrinfo(list);
+      close(sockfd);
+      return ERECV;
+    }
+    if (now - sent_at >= UDP_RETRY * 1000000LL){
+      sendto(sockfd, request.c_str(), request.length(), 0, list->ai_addr, list->ai_addrlen);
+      sent_at = now;
+    }
+    struct pollfd pfd = {sockfd, POLLIN, 0};
+    length = 0;
+    if (poll(&pfd, 1, UDP_RETRY) == 1){
+      from_size = sizeof from;
+      length = recvfrom(sockfd, msg, UDP_DATAGRAM, 0, (struct sockaddr*)&from, &from_size);
+    }
+  }
+  freeaddrinfo(list);
+  long long rtt = now_ns() - sent_at;
+  if (msg[0] == '9'){
+    close(sockfd);
+    return EFILE;
+  }
+
+  msg[length] = '\0';
+  char *end;
+  long long file_len = strtoll(msg + 1, &end, 10);
+  if (length < 2 || *end != '\0' || file_len < 0){
+    close(sockfd);
+    return EPROTOCOL;
+  }
+  if (connect(sockfd, (struct sockaddr*)&from, from_size) == -1 || send(sockfd, "1", 1, 0) == -1){
+    close(sockfd);
+    return ECONNECTION;
+  }
+  timeline.mark_connected();
+
+  unsigned long blocks = (file_len + UDP_PAYLOAD - 1) / UDP_PAYLOAD;
+  vector<bool> received(blocks, false);
+  vector<long long> nacked(blocks, 0); // time of the last NACK of the block
+  unsigned long count = 0;
+  unsigned long first_missing = 0;
+  unsigned long horizon = 0; // highest received sequence number + 1
+  unsigned long nacks = 0, duplicates = 0, dropped = 0;
+  long long interval = 2 * rtt > UDP_NACKMIN * 1000000LL ? 2 * rtt : UDP_NACKMIN * 1000000LL;
+  long long last_data = now_ns();
+  long long next_check = last_data + interval;
+  BlockRecord record;
+  record.wait = last_data;
+  int stat = EOK;
+
+  while (count < blocks && stat == EOK){
+    long long now = now_ns();
+    if (now - last_data > UDP_TIMEOUT * 1000000LL){
+      stat = ERECV;
+      break;
+    }
+    if (now >= next_check){ // report blocks still missing, all of them if nothing comes
+      bool idle = now - last_data >= interval;
+      if (idle || horizon > 0){
+        string nack = build_nack(received, nacked, first_missing, idle ? blocks - 1 : horizon - 1,
+                                 now, interval);
+        if (!nack.empty() && send(sockfd, nack.c_str(), nack.length(), 0) != -1)
+          nacks++;
+      }
+      next_check = now + interval / 2;
+    }
+
+    struct pollfd pfd = {sockfd, POLLIN, 0};
+    if (poll(&pfd, 1, (next_check - now + 999999) / 1000000) != 1)
+      continue;
+    if ((length = recv(sockfd, msg, UDP_DATAGRAM, 0)) == -1){
+      if (errno == ECONNREFUSED)
+        stat = ERECV; // server is gone
+      continue;
+    }
+    if (length > 0 && msg[0] == '5'){ // our "1" was lost or the transfer is paused
+      last_data = now_ns();
+      send(sockfd, "1", 1, 0);
+      continue;
+    }
+    if (length < UDP_HEADER || msg[0] != '8')
+      continue;
+    if (params.loss && rand() % 100 < params.loss){
+      dropped++;
+      continue;
+    }
+
+    record.received = now_ns();
+    last_data = record.received;
+    char seq_str[UDP_SEQLEN + 1];
+    memcpy(seq_str, msg + 1, UDP_SEQLEN);
+    seq_str[UDP_SEQLEN] = '\0';
+    unsigned long seq = strtoul(seq_str, NULL, 10);
+    size_t bytes = length - UDP_HEADER;
+    if (seq >= blocks || (long long)bytes != MIN(UDP_PAYLOAD, file_len - (long long)seq * UDP_PAYLOAD)){
+      stat = EPROTOCOL;
+      break;
+    }
+    if (received[seq]){
+      duplicates++;
+      continue;
+    }
+    if ((stat = params.write_at(msg + UDP_HEADER, bytes, (off_t)seq * UDP_PAYLOAD)) != EOK)
+      break;
+    received[seq] = true;
+    count++;
+    while (first_missing < blocks && received[first_missing])
+      first_missing++;
+
+    if (seq > horizon){ // gap, report it at once
+      string nack = build_nack(received, nacked, horizon, seq - 1, record.received, interval);
+      if (!nack.empty() && send(sockfd, nack.c_str(), nack.length(), 0) != -1)
+        nacks++;
+    }
+    if (seq >= horizon)
+      horizon = seq + 1;
+
+    if (timeline.enabled()){
+      record.written = now_ns();
+      record.acked = record.written;
+      record.seq = seq;
+      record.bytes = bytes;
+      timeline.add_block(record);
+      record.wait = record.written;
+    }
+  }
+
+  if (stat == EOK){ // whole file, "2" is repeated while the server still sends
+    timeline.mark_end();
+    send(sockfd, "2", 1, 0);
+    struct pollfd pfd = {sockfd, POLLIN, 0};
+    while (poll(&pfd, 1, 3 * UDP_RETRY) == 1 && recv(sockfd, msg, UDP_DATAGRAM, 0) > 0)
+      send(sockfd, "2", 1, 0);
+  }
+  timeline.set_udp(nacks, duplicates, dropped);
+  close(sockfd);
+  return stat;
+}
+
 //////// MAIN PROGRAM ////////
 int main (int argc, char *argv[]) {
   int stat = EOK;
+  signal(SIGPIPE, SIG_IGN); // closed output pipe is reported by write()
   Params params(argc, argv);
+  Timeline timeline(params.summary, params.trace); // before the output is truncated
+  params.open_file();
+
+  if (params.udp){
+    srand(time(NULL) ^ getpid()); // for loss injection
+    stat = receive_file_udp(params, timeline);
+    params.close_file();
+    timeline.report(params, stat);
+    error_exit(stat);
+    return EXIT_SUCCESS;
+  }
+
+  RateLimit limit;
+  if (params.rate && !limit.open(params.rate_file, params.rate)){
+    params.close_file();
+    timeline.report(params, ERATE);
+    error_exit(ERATE);
+  }
 
   int socketfd;
-  if ((stat = connect(params, &socketfd)) != EOK){
+  if ((stat = connect(params, &socketfd, timeline)) != EOK){
     params.close_file();
+    timeline.report(params, stat);
     error_exit(stat);
   }
 
-  string send_msg = params.filename + ";\n"; // send me file wih given filename
+  // send me file wih given filename
+  string send_msg = params.filename + (params.adaptive ? ADAPT_REQUEST : ";\n");
+  timeline.mark_requested();
   if (send(socketfd, send_msg.c_str(), send_msg.length(), 0) == -1) {
     params.close_file();
     close(socketfd);
+    timeline.report(params, ESEND);
     error_exit(ESEND);
   }
   
-  if ((stat = receive_file(params, socketfd)) != EOK){
+  if (params.adaptive)
+    stat = receive_frames(params, socketfd, timeline, limit);
+  else
+    stat = receive_file(params, socketfd, timeline, limit);
+  if (stat != EOK){
     params.close_file();
     close(socketfd);
+    timeline.report(params, stat);
     error_exit(stat);
   }
 
   close(socketfd);
   params.close_file();
+  timeline.report(params, EOK);
   return EXIT_SUCCESS;
 }
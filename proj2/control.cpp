@@ -0,0 +1,368 @@
+/**
+  * File:    control.cpp
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Runtime control of the file server (server -c path).
+  *          IPP project 2, FIT VUTBR
+  */
+
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "control.h"
+
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+using namespace std;
+
+/** Converts rate in kB/s to microseconds for sending one block */
+static unsigned long sending_time_of(unsigned long rate){
+  return rate ? (unsigned long)(1000000.0 / rate) : 0;
+}
+
+/**
+ * Creates the table in memory shared with children forked later
+ * @param rate Global rate in kB/s
+ * @return NULL if the memory could not be mapped
+ */
+ControlTable *control_create(unsigned long rate){
+  void *memory = mmap(NULL, sizeof(ControlTable), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED)
+    return NULL;
+  ControlTable *table = static_cast<ControlTable *>(memory); // zeroed by mmap
+  table->rate = rate;
+  table->next_id = 1;
+  return table;
+}
+
+/**
+ * Reserves slot for a transfer of the client, before the child is forked
+ * @return NULL if the table is full
+ */
+TransferSlot *control_reserve(ControlTable *table, const string &client){
+  for (int i = 0; i < CONTROL_TRANSFERS; i++){
+    TransferSlot *slot = &table->transfers[i];
+    if (slot->pid != 0)
+      continue;
+    slot->pid = -1;
+    slot->id = table->next_id++;
+    strncpy(slot->client, client.c_str(), sizeof slot->client - 1);
+    slot->client[sizeof slot->client - 1] = '\0';
+    slot->file[0] = '\0';
+    slot->size = -1;
+    slot->sent = 0;
+    slot->rate = 0;
+    slot->paused = 0;
+    slot->finished = 0;
+    control_update(table);
+    return slot;
+  }
+  return NULL;
+}
+
+/** Assigns forked child to its reserved slot, frees the slot if fork failed */
+void control_started(ControlTable *table, TransferSlot *slot, pid_t pid){
+  if (slot == NULL)
+    return;
+  slot->pid = pid > 0 ? pid : 0;
+  control_update(table);
+}
+
+/**
+ * Frees slot of finished child, safe to call from a signal handler
+ * @return true if the child had a slot
+ */
+bool control_release(ControlTable *table, pid_t pid){
+  for (int i = 0; i < CONTROL_TRANSFERS; i++){
+    if (table->transfers[i].pid == pid){
+      table->transfers[i].finished = 1;
+      table->transfers[i].pid = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Collects files requested by the finished children, a slot reused
+ * meanwhile is lost
+ */
+void control_collect(ControlTable *table, vector<string> &files){
+  for (int i = 0; i < CONTROL_TRANSFERS; i++){
+    TransferSlot *slot = &table->transfers[i];
+    if (slot->pid != 0 || !slot->finished)
+      continue;
+    if (slot->file[0] != '\0')
+      files.push_back(slot->file);
+    slot->finished = 0;
+  }
+}
+
+/** Returns rate of the client, 0 if it has none */
+static unsigned long client_rate(const ControlTable *table, const char *client){
+  for (int i = 0; i < CONTROL_CLIENTS; i++)
+    if (strcmp(table->clients[i].client, client) == 0)
+      return table->clients[i].rate;
+  return 0;
+}
+
+/**
+ * Computes sending time of every transfer: own rate, else an even share
+ * of the rate of its client, else the global rate
+ */
+void control_update(ControlTable *table){
+  for (int i = 0; i < CONTROL_TRANSFERS; i++){
+    TransferSlot *slot = &table->transfers[i];
+    if (slot->pid == 0)
+      continue;
+    unsigned long rate = slot->rate;
+    if (rate == 0 && (rate = client_rate(table, slot->client)) != 0){
+      unsigned long sharing = 0;
+      for (int j = 0; j < CONTROL_TRANSFERS; j++)
+        if (table->transfers[j].pid != 0 && table->transfers[j].rate == 0 &&
+            strcmp(table->transfers[j].client, slot->client) == 0)
+          sharing++;
+      rate = MAX(rate / sharing, 1);
+    }
+    if (rate == 0)
+      rate = table->rate;
+    slot->sending_time = sending_time_of(rate);
+  }
+}
+
+/** Finds transfer by its id, NULL if it is not active */
+static TransferSlot *find_transfer(ControlTable *table, const string &id){
+  char *end;
+  unsigned long number = strtoul(id.c_str(), &end, 10);
+  if (id.empty() || *end != '\0')
+    return NULL;
+  for (int i = 0; i < CONTROL_TRANSFERS; i++)
+    if (table->transfers[i].pid > 0 && table->transfers[i].id == number)
+      return &table->transfers[i];
+  return NULL;
+}
+
+/** Parses rate in kB/s, returns false if it is not a number */
+static bool parse_rate(const string &str, unsigned long *rate){
+  char *end;
+  *rate = strtoul(str.c_str(), &end, 10);
+  return !str.empty() && *end == '\0' && str[0] != '-';
+}
+
+/** Sets rate of the client, 0 removes it */
+static bool set_client_rate(ControlTable *table, const string &client, unsigned long rate){
+  ClientRate *free_entry = NULL;
+  for (int i = 0; i < CONTROL_CLIENTS; i++){
+    ClientRate *entry = &table->clients[i];
+    if (client == entry->client){
+      if (rate == 0)
+        entry->client[0] = '\0';
+      entry->rate = rate;
+      return true;
+    }
+    if (free_entry == NULL && entry->client[0] == '\0')
+      free_entry = entry;
+  }
+  if (rate == 0)
+    return true;
+  if (free_entry == NULL || client.length() >= sizeof free_entry->client)
+    return false;
+  strcpy(free_entry->client, client.c_str());
+  free_entry->rate = rate;
+  return true;
+}
+
+/** Sets pause flag of one transfer or of all of them */
+static bool set_paused(ControlTable *table, const string &which, int paused){
+  if (which == "all"){
+    for (int i = 0; i < CONTROL_TRANSFERS; i++)
+      if (table->transfers[i].pid != 0)
+        table->transfers[i].paused = paused;
+    return true;
+  }
+  TransferSlot *slot = find_transfer(table, which);
+  if (slot == NULL)
+    return false;
+  slot->paused = paused;
+  return true;
+}
+
+/**
+ * Executes one command of the control socket
+ * @return Answer to be sent, ends with "OK\n" or "ERR <reason>\n"
+ */
+string control_command(ControlTable *table, const string &line){
+  istringstream words(line);
+  string command, arg1, arg2, arg3, rest;
+  words >> command >> arg1 >> arg2 >> arg3 >> rest;
+  unsigned long rate;
+
+  if (command == "list" && arg1.empty()){
+    ostringstream answer;
+    for (int i = 0; i < CONTROL_TRANSFERS; i++){
+      const TransferSlot *slot = &table->transfers[i];
+      if (slot->pid <= 0)
+        continue;
+      unsigned long sending_time = slot->sending_time;
+      answer << slot->id << " " << slot->client << " " << (slot->file[0] ? slot->file : "-")
+             << " " << slot->sent << " " << slot->size << " "
+             << (sending_time ? 1000000 / sending_time : 0) << " " << slot->paused << "\n";
+    }
+    return answer.str() + "OK\n";
+  }
+
+  if (command == "rate" && rest.empty()){
+    if (arg1 == "global" && arg3.empty() && parse_rate(arg2, &rate) && rate > 0){
+      table->rate = rate;
+    }else if (arg1 == "client" && parse_rate(arg3, &rate)){
+      if (!set_client_rate(table, arg2, rate))
+        return "ERR too many clients\n";
+    }else if (arg1 == "transfer" && parse_rate(arg3, &rate)){
+      TransferSlot *slot = find_transfer(table, arg2);
+      if (slot == NULL)
+        return "ERR no such transfer\n";
+      slot->rate = rate;
+    }else{
+      return "ERR usage: rate global <kBps> | client <host> <kBps> | transfer <id> <kBps>\n";
+    }
+    control_update(table);
+    return "OK\n";
+  }
+
+  if ((command == "pause" || command == "resume") && !arg1.empty() && arg2.empty()){
+    if (!set_paused(table, arg1, command == "pause"))
+      return "ERR no such transfer\n";
+    return "OK\n";
+  }
+
+  return "ERR unknown command\n";
+}
+
+/**
+ * Creates Unix socket listening for control connections, replaces
+ * a socket left by a previous run
+ * @return false on error
+ */
+bool ControlSocket::open(const string &path){
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if (path.length() >= sizeof addr.sun_path)
+    return false;
+  strcpy(addr.sun_path, path.c_str());
+
+  if ((listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+    return false;
+  unlink(path.c_str());
+  if (bind(listenfd, (struct sockaddr *)&addr, sizeof addr) == -1 || listen(listenfd, 5) == -1){
+    ::close(listenfd);
+    listenfd = -1;
+    return false;
+  }
+  return true;
+}
+
+/** Adds the listening socket and the connections to be polled */
+void ControlSocket::add_fds(vector<struct pollfd> &fds){
+  if (listenfd == -1)
+    return;
+  struct pollfd pfd = {listenfd, POLLIN, 0};
+  fds.push_back(pfd);
+  for (map<int, string>::iterator i = connections.begin(); i != connections.end(); i++){
+    pfd.fd = i->first;
+    fds.push_back(pfd);
+  }
+}
+
+/** Accepts connections and executes complete commands of the polled ones */
+void ControlSocket::handle(const vector<struct pollfd> &fds, ControlTable *table){
+  for (size_t i = 0; i < fds.size(); i++){
+    if (!fds[i].revents)
+      continue;
+    if (fds[i].fd == listenfd){
+      int fd;
+      if ((fd = accept(listenfd, NULL, NULL)) != -1)
+        connections[fd] = "";
+      continue;
+    }
+    map<int, string>::iterator connection = connections.find(fds[i].fd);
+    if (connection == connections.end())
+      continue;
+
+    char buffer[CONTROL_LINE];
+    ssize_t length = recv(connection->first, buffer, sizeof buffer, MSG_DONTWAIT);
+    if (length == -1 && (errno == EAGAIN || errno == EINTR))
+      continue;
+    bool closed = length <= 0;
+    if (!closed)
+      connection->second.append(buffer, length);
+
+    size_t end;
+    string &input = connection->second;
+    while (!closed && (end = input.find('\n')) != string::npos){
+      string answer = control_command(table, input.substr(0, end));
+      input.erase(0, end + 1);
+      if (send(connection->first, answer.c_str(), answer.length(), MSG_NOSIGNAL) == -1)
+        closed = true;
+    }
+    if (closed || input.length() > CONTROL_LINE){ // gone or not sending lines
+      ::close(connection->first);
+      connections.erase(connection);
+    }
+  }
+}
+
+/** Closes all sockets, called by a forked child */
+void ControlSocket::close(){
+  if (listenfd != -1)
+    ::close(listenfd);
+  for (map<int, string>::iterator i = connections.begin(); i != connections.end(); i++)
+    ::close(i->first);
+  listenfd = -1;
+  connections.clear();
+}
+
+/** Records requested file of the transfer, called by the child */
+void control_file(TransferSlot *slot, const string &file, long long size){
+  if (slot == NULL)
+    return;
+  strncpy(slot->file, file.c_str(), sizeof slot->file - 1);
+  slot->file[sizeof slot->file - 1] = '\0';
+  slot->size = size;
+}
+
+/** Adds bytes sent by the child */
+void control_sent(TransferSlot *slot, long long bytes){
+  if (slot != NULL)
+    slot->sent += bytes;
+}
+
+/**
+ * Returns current sending time of one block of the transfer
+ * @param slot NULL if the transfer did not fit to the table
+ * @param paused Set if the transfer is paused
+ */
+unsigned long control_pacing(const ControlTable *table, const TransferSlot *slot, bool *paused){
+  if (slot == NULL){
+    *paused = false;
+    return sending_time_of(table->rate);
+  }
+  *paused = slot->paused;
+  return slot->sending_time;
+}
+
+/** Waits while the transfer is paused, returns its sending time */
+unsigned long control_wait(const ControlTable *table, const TransferSlot *slot){
+  bool paused;
+  unsigned long sending_time;
+  while ((sending_time = control_pacing(table, slot, &paused)), paused)
+    usleep(CONTROL_PAUSE * 1000);
+  return sending_time;
+}
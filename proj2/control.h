@@ -0,0 +1,93 @@
+/**
+  * File:    control.h
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Runtime control of the file server (server -c path).
+  *          IPP project 2, FIT VUTBR
+  *
+  * Transfers are kept in a table shared by the server and its children.
+  * Only the server writes the rates, a child reads the sending time and
+  * the pause flag of its slot before every block and reports sent bytes.
+  *
+  * Commands accepted on the Unix socket, one per line, every answer
+  * ends with "OK" or "ERR <reason>":
+  *   list                        active transfers, one per line:
+  *                               id client file sent size rate_kBps paused
+  *   rate global <kBps>          rate of each transfer, as -d
+  *   rate client <host> <kBps>   rate shared by transfers of the client,
+  *                               0 removes it
+  *   rate transfer <id> <kBps>   rate of one transfer, 0 removes it
+  *   pause <id>|all
+  *   resume <id>|all
+  */
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <sys/types.h>
+#include <netdb.h>
+#include <poll.h>
+
+#define CONTROL_TRANSFERS 256 // transfers in the table, more are not controlled
+#define CONTROL_CLIENTS 64 // clients with their own rate
+#define CONTROL_NAMELEN 256 // stored length of the file name
+#define CONTROL_PAUSE 10 // ms between checks of a paused transfer
+#define CONTROL_LINE 1024 // longest command
+
+/** Transfer served by a child */
+struct TransferSlot {
+  volatile pid_t pid; // 0 - free, -1 - reserved before fork
+  unsigned long id;
+  char client[NI_MAXHOST];
+  char file[CONTROL_NAMELEN]; // written by the child
+  volatile long long size; // -1 - not known yet
+  volatile long long sent;
+  volatile unsigned long rate; // own rate in kB/s, 0 - not set
+  volatile unsigned long sending_time; // us for one block, computed by server
+  volatile int paused;
+  volatile int finished; // child was reaped, file not collected yet
+};
+
+/** Rate of all transfers of one client */
+struct ClientRate {
+  char client[NI_MAXHOST]; // empty - free
+  unsigned long rate; // kB/s
+};
+
+/** Table in memory shared by the server and its children */
+struct ControlTable {
+  unsigned long rate; // global rate in kB/s
+  unsigned long next_id;
+  ClientRate clients[CONTROL_CLIENTS];
+  TransferSlot transfers[CONTROL_TRANSFERS];
+};
+
+ControlTable *control_create(unsigned long rate);
+TransferSlot *control_reserve(ControlTable *table, const std::string &client);
+void control_started(ControlTable *table, TransferSlot *slot, pid_t pid);
+bool control_release(ControlTable *table, pid_t pid);
+void control_collect(ControlTable *table, std::vector<std::string> &files);
+void control_update(ControlTable *table);
+std::string control_command(ControlTable *table, const std::string &line);
+
+/** Control socket and its connections, served by the server process */
+class ControlSocket {
+  public:
+    ControlSocket() : listenfd(-1) {}
+    bool open(const std::string &path);
+    void add_fds(std::vector<struct pollfd> &fds);
+    void handle(const std::vector<struct pollfd> &fds, ControlTable *table);
+    void close();
+  private:
+    int listenfd;
+    std::map<int, std::string> connections; // received part of a command
+};
+
+void control_file(TransferSlot *slot, const std::string &file, long long size);
+void control_sent(TransferSlot *slot, long long bytes);
+unsigned long control_pacing(const ControlTable *table, const TransferSlot *slot, bool *paused);
+unsigned long control_wait(const ControlTable *table, const TransferSlot *slot);
+
+#endif
@@ -0,0 +1,220 @@
+/**
+  * File:    index.cpp
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Index of files served by the server (server -i).
+  *          IPP project 2, FIT VUTBR
+  */
+
+#include <string>
+#include <set>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "index.h"
+
+// changes of directories which are watched
+#define INDEX_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | \
+                    IN_MOVED_FROM | IN_MOVED_TO)
+
+using namespace std;
+
+/** Returns key of the requested file, "./" at the beginning is ignored */
+static string index_key(const string &name){
+  size_t start = 0;
+  while (name.compare(start, 2, "./") == 0)
+    start += 2;
+  return name.substr(start);
+}
+
+FileIndex::~FileIndex(){
+  clear();
+  if (notifyfd != -1)
+    close(notifyfd);
+}
+
+/**
+ * Indexes the working directory and starts watching it
+ * @return false if inotify is not available or a directory cannot be watched
+ */
+bool FileIndex::build(){
+  if ((notifyfd = inotify_init1(IN_NONBLOCK)) == -1)
+    return false;
+  return walk("");
+}
+
+/**
+ * Watches the directory and indexes files in it and in its subdirectories
+ * @param dir Path relative to the working directory, "" for itself
+ * @return false if some directory could not be watched
+ */
+bool FileIndex::walk(const string &dir){
+  int wd;
+  if ((wd = inotify_add_watch(notifyfd, dir.empty() ? "." : dir.c_str(), INDEX_MASK)) == -1)
+    return false;
+  watches[wd] = dir; // directory moved in keeps its descriptor
+  DIR *stream;
+  if ((stream = opendir(dir.empty() ? "." : dir.c_str())) == NULL)
+    return true; // removed meanwhile
+
+  bool watched = true;
+  struct dirent *item;
+  while ((item = readdir(stream)) != NULL){
+    string name = item->d_name;
+    if (name == "." || name == "..")
+      continue;
+    string path = dir.empty() ? name : dir + "/" + name;
+    struct stat info;
+    if (lstat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) // links to directories are not followed
+      watched = walk(path) && watched;
+    else
+      update(path);
+  }
+  closedir(stream);
+  return watched;
+}
+
+/** Updates the file after a change, removes it if it is not a regular file anymore */
+void FileIndex::update(const string &path){
+  struct stat info;
+  bool regular = stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+  unordered_map<string, IndexEntry>::iterator found = files.find(path);
+  if (found != files.end()){
+    close_file(found->second); // content could be replaced
+    if (!regular){
+      files.erase(found);
+      return;
+    }
+  }else{
+    if (!regular)
+      return;
+    IndexEntry entry;
+    entry.fd = -1;
+    found = files.insert(make_pair(path, entry)).first;
+  }
+  found->second.size = info.st_size;
+  found->second.mtime = info.st_mtime;
+}
+
+/** Removes files and watches of removed or moved directory */
+void FileIndex::remove_dir(const string &dir){
+  string prefix = dir + "/";
+  unordered_map<string, IndexEntry>::iterator file = files.begin();
+  while (file != files.end()){
+    if (file->first.compare(0, prefix.length(), prefix) == 0){
+      close_file(file->second);
+      file = files.erase(file);
+    }else{
+      file++;
+    }
+  }
+  map<int, string>::iterator watch = watches.begin();
+  while (watch != watches.end()){
+    if (watch->second == dir || watch->second.compare(0, prefix.length(), prefix) == 0){
+      inotify_rm_watch(notifyfd, watch->first);
+      watches.erase(watch++);
+    }else{
+      watch++;
+    }
+  }
+}
+
+/** Processes pending inotify events, the index is rebuilt if some were lost */
+void FileIndex::handle_events(){
+  char buffer[INDEX_EVENTS] __attribute__((aligned(__alignof__(struct inotify_event))));
+  set<string> changed; // each file is checked once
+  bool overflow = false;
+  ssize_t length;
+
+  while ((length = read(notifyfd, buffer, sizeof buffer)) > 0){
+    const struct inotify_event *event;
+    for (char *ptr = buffer; ptr < buffer + length; ptr += sizeof(struct inotify_event) + event->len){
+      event = reinterpret_cast<const struct inotify_event *>(ptr);
+      if (event->mask & IN_Q_OVERFLOW){
+        overflow = true;
+        continue;
+      }
+      map<int, string>::iterator dir = watches.find(event->wd);
+      if (dir == watches.end())
+        continue;
+      if (event->mask & IN_IGNORED){ // directory was removed
+        watches.erase(dir);
+        continue;
+      }
+      if (event->len == 0)
+        continue;
+      string path = dir->second.empty() ? event->name : dir->second + "/" + event->name;
+      if (!(event->mask & IN_ISDIR)){
+        changed.insert(path);
+        continue;
+      }
+      if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+        remove_dir(path);
+      if (event->mask & (IN_CREATE | IN_MOVED_TO))
+        walk(path);
+    }
+  }
+
+  if (overflow){
+    clear();
+    walk("");
+    return;
+  }
+  for (set<string>::iterator i = changed.begin(); i != changed.end(); i++)
+    update(*i);
+}
+
+/**
+ * Finds the file, does not touch the file system
+ * @return NULL if the file is not indexed
+ */
+const IndexEntry *FileIndex::lookup(const string &name) const {
+  unordered_map<string, IndexEntry>::const_iterator found = files.find(index_key(name));
+  return found == files.end() ? NULL : &found->second;
+}
+
+/**
+ * Returns descriptor of the indexed file, opens it if it is not open yet
+ * and closes the least recently used one over INDEX_FDS
+ * @return -1 if the file is not indexed or cannot be opened
+ */
+int FileIndex::open_file(const string &name){
+  string key = index_key(name);
+  unordered_map<string, IndexEntry>::iterator found = files.find(key);
+  if (found == files.end())
+    return -1;
+  IndexEntry &entry = found->second;
+  if (entry.fd != -1){
+    opened.splice(opened.begin(), opened, entry.used);
+    return entry.fd;
+  }
+
+  if (opened.size() >= INDEX_FDS)
+    close_file(files.find(opened.back())->second);
+  if ((entry.fd = open(key.c_str(), O_RDONLY)) == -1)
+    return -1;
+  opened.push_front(key);
+  entry.used = opened.begin();
+  return entry.fd;
+}
+
+/** Closes descriptor of the file if it is open */
+void FileIndex::close_file(IndexEntry &entry){
+  if (entry.fd == -1)
+    return;
+  close(entry.fd);
+  opened.erase(entry.used);
+  entry.fd = -1;
+}
+
+/** Forgets all files and stops watching */
+void FileIndex::clear(){
+  for (unordered_map<string, IndexEntry>::iterator i = files.begin(); i != files.end(); i++)
+    close_file(i->second);
+  for (map<int, string>::iterator i = watches.begin(); i != watches.end(); i++)
+    inotify_rm_watch(notifyfd, i->first);
+  files.clear();
+  watches.clear();
+}
@@ -0,0 +1,59 @@
+/**
+  * File:    index.h
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Index of files served by the server (server -i).
+  *          IPP project 2, FIT VUTBR
+  *
+  * The server walks its working directory at startup and keeps size and
+  * modification time of every regular file, kept current through inotify.
+  * Requests are answered from the index, a file missing there is not
+  * looked up on the disk. Recently requested files are kept open, up to
+  * INDEX_FDS descriptors; children inherit the index and the descriptors
+  * from the time of fork and read the files by pread().
+  */
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <string>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <sys/types.h>
+#include <ctime>
+
+#define INDEX_FDS 64 // open descriptors kept by the index
+#define INDEX_EVENTS 4096 // bytes of inotify events read at once
+
+/** Indexed regular file */
+struct IndexEntry {
+  off_t size;
+  time_t mtime;
+  int fd; // -1 - not open
+  std::list<std::string>::iterator used; // position in the open files, if open
+};
+
+/** Files under the working directory, by their relative path */
+class FileIndex {
+  public:
+    FileIndex() : notifyfd(-1) {}
+    ~FileIndex();
+    bool build();
+    int fd() const { return notifyfd; }
+    void handle_events();
+    const IndexEntry *lookup(const std::string &name) const;
+    int open_file(const std::string &name);
+    size_t size() const { return files.size(); }
+  private:
+    bool walk(const std::string &dir);
+    void update(const std::string &path);
+    void remove_dir(const std::string &dir);
+    void close_file(IndexEntry &entry);
+    void clear();
+    std::unordered_map<std::string, IndexEntry> files;
+    std::map<int, std::string> watches; // watched directories by descriptor
+    std::list<std::string> opened; // open files, the most recently used first
+    int notifyfd;
+};
+
+#endif
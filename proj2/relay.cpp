@@ -0,0 +1,537 @@
+/**
+  * File:    relay.cpp
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: TCP relay adding delay, jitter, bandwidth limit and segment
+  *          splitting between client and server, for benchmarking
+  *          the protocol without root privileges (tc/netem).
+  *          IPP project 2, FIT VUTBR
+  *          Usage: relay [-u] -l port -t host:port [-d delay_ms] [-j jitter_ms]
+  *                 [-b bandwidth_kBps] [-s split_bytes]
+  *          With -u datagrams of the UDP transport are relayed instead.
+  */
+
+#include <iostream>
+#include <string>
+#include <deque>
+#include <map>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <cerrno>
+#include <signal.h>
+#include <sys/wait.h>
+#include <netdb.h>
+#include <ctime>
+
+#include "../common/connector.h"
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define BUFFSIZE (64 * 1024)
+#define MAXQUEUED (4 * 1024 * 1024) // bytes delayed in one direction before reading stops
+#define UDP_SESSION 30 // s of inactivity after which a UDP client is forgotten
+#define UDP_RCVBUF (1 << 20) // receive buffer of the UDP sockets, bytes
+
+using namespace std;
+
+/** Error values */
+enum {
+  EOK = 0, // No error detected
+  EPARAMNUM, // Wrong number of parameters
+  EPARAM, // Wrong parameter
+  ERECV, // RECV
+  ESEND, // SEND
+  ECONNECTION,
+  EHOST,
+  EFORK,
+  EUNKNOWN // Unknown error
+};
+
+/** Error messages */
+const char *ECODEMSG[] = {
+  "Everything is OK.",
+  "Wrong number of parameters",
+  "Wrong parameter",
+  "Failed to receive a message",
+  "Failed to send a message",
+  "Failed to connect to server",
+  "Host is not available",
+  "Fork error",
+  "Unknown error"
+};
+
+/**
+ * Prints error messages according to given error code and exits;
+ * @param ecode Error code
+ */
+void error_exit(int eCode){
+  if (eCode == EOK)
+    return;
+
+  if (eCode < EOK || eCode > EUNKNOWN)
+    eCode = EUNKNOWN;
+
+  cerr << ECODEMSG[eCode] << endl;
+  exit(eCode);
+}
+
+/** Returns monotonic time in microseconds */
+static long long now_us(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+ * Class for holding data from given parameters
+ */
+class Params{
+  public:
+    Params(int argc, char *argv[]);
+    string port; // listening port
+    string host; // target
+    string target_port;
+    long long delay; // one way delay in us
+    long long jitter; // maximal additional delay in us
+    unsigned long bandwidth; // bytes per second, 0 - unlimited
+    unsigned long split; // maximal size of forwarded segment, 0 - unchanged
+    bool udp; // relay UDP transport
+  private:
+    long get_number(const string &str);
+};
+
+/** Converts string to non-negative number, returns -1 if it is not a number */
+long Params::get_number(const string &str){
+  if (str.empty() || str.length() > 9)
+    return -1;
+  for (string::const_iterator i = str.begin(); i != str.end(); i++)
+    if (!isdigit(*i))
+      return -1;
+  return atol(str.c_str());
+}
+
+/**
+ * Processes given parameters.
+ * @param argc Number of program parameters
+ * @param argv Parameters
+ */
+Params::Params(int argc, char *argv[]){
+  delay = 0;
+  jitter = 0;
+  bandwidth = 0;
+  split = 0;
+  udp = false;
+
+  if (argc < 5)
+    error_exit(EPARAMNUM);
+
+  for (int i = 1; i < argc; i++){
+    if (strcmp(argv[i], "-u") == 0){
+      udp = true;
+      continue;
+    }
+    if (i + 1 == argc) // option without value
+      error_exit(EPARAMNUM);
+    const char *option = argv[i];
+    string value = argv[++i];
+    long number = get_number(value);
+    if (strcmp(option, "-l") == 0 && number > 0)
+      port = value;
+    else if (strcmp(option, "-t") == 0 && value.find(":") != string::npos){
+      host = value.substr(0, value.rfind(":"));
+      target_port = value.substr(value.rfind(":") + 1);
+      if (host.empty() || get_number(target_port) <= 0)
+        error_exit(EPARAM);
+    }
+    else if (strcmp(option, "-d") == 0 && number >= 0)
+      delay = number * 1000;
+    else if (strcmp(option, "-j") == 0 && number >= 0)
+      jitter = number * 1000;
+    else if (strcmp(option, "-b") == 0 && number >= 0)
+      bandwidth = number * 1000;
+    else if (strcmp(option, "-s") == 0 && number >= 0)
+      split = number;
+    else
+      error_exit(EPARAM);
+  }
+
+  if (port.empty() || host.empty())
+    error_exit(EPARAMNUM);
+}
+
+/** Data waiting for delivery */
+struct Segment{
+  long long due; // time of delivery in us
+  string data;
+};
+
+/**
+ * One direction of the relayed connection. Received data are cut into
+ * segments which are delivered after the delay, in order, no faster
+ * than the bandwidth allows.
+ */
+class Direction{
+  public:
+    Direction(const Params &params, int from, int to);
+    void receive(const char *data, size_t length);
+    int deliver();
+    long long next_due() const;
+    bool want_read() const { return !eof && queued < MAXQUEUED; }
+    bool finished() const { return eof && queue.empty(); }
+    int from, to;
+    bool eof; // sender closed its side
+  private:
+    const Params &params;
+    deque<Segment> queue;
+    size_t queued; // bytes in queue
+    size_t sent; // bytes of the first segment already delivered
+    long long link_free; // time when the previous segment left the link
+    long long last_due; // delivery time of the previous segment
+};
+
+Direction::Direction(const Params &params, int from, int to) : params(params){
+  this->from = from;
+  this->to = to;
+  eof = false;
+  queued = 0;
+  sent = 0;
+  link_free = 0;
+  last_due = 0;
+}
+
+/** Queues received data */
+void Direction::receive(const char *data, size_t length){
+  size_t segment = params.split ? params.split : length;
+  for (size_t pos = 0; pos < length; pos += segment){
+    Segment s;
+    s.data.assign(data + pos, MIN(segment, length - pos));
+
+    long long now = now_us();
+    long long start = link_free > now ? link_free : now;
+    link_free = start + (params.bandwidth ? s.data.length() * 1000000LL / params.bandwidth : 0);
+    s.due = link_free + params.delay;
+    if (params.jitter)
+      s.due += rand() % (params.jitter + 1);
+    if (s.due < last_due) // TCP keeps the order
+      s.due = last_due;
+    last_due = s.due;
+
+    queued += s.data.length();
+    queue.push_back(s);
+  }
+}
+
+/** Sends segments which are due, returns error value */
+int Direction::deliver(){
+  long long now = now_us();
+  while (!queue.empty() && queue.front().due <= now){
+    Segment &s = queue.front();
+    ssize_t n = send(to, s.data.data() + sent, s.data.length() - sent, MSG_NOSIGNAL);
+    if (n == -1){
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return EOK;
+      return ESEND;
+    }
+    sent += n;
+    if (sent < s.data.length())
+      return EOK;
+    queued -= s.data.length();
+    sent = 0;
+    queue.pop_front();
+  }
+  if (finished())
+    shutdown(to, SHUT_WR);
+  return EOK;
+}
+
+/** Returns delivery time of the first queued segment, -1 if there is none */
+long long Direction::next_due() const{
+  return queue.empty() ? -1 : queue.front().due;
+}
+
+/** Relays data between client and server until both sides close */
+int relay(const Params &params, int clientfd, int serverfd){
+  Direction up(params, clientfd, serverfd);
+  Direction down(params, serverfd, clientfd);
+  Direction *directions[2] = {&up, &down};
+  char buffer[BUFFSIZE];
+
+  while (!up.finished() || !down.finished()){
+    struct pollfd fds[2];
+    long long now = now_us();
+    long long timeout = -1; // us
+    for (int i = 0; i < 2; i++){
+      fds[i].fd = directions[i]->from;
+      fds[i].events = directions[i]->want_read() ? POLLIN : 0;
+      fds[i].revents = 0;
+    }
+    for (int i = 0; i < 2; i++){
+      long long due = directions[i]->next_due();
+      if (due == -1)
+        continue;
+      if (due <= now){ // blocked by the receiver, wait until it is writable
+        fds[1 - i].events |= POLLOUT;
+        due = now + 1000;
+      }
+      if (timeout == -1 || due - now < timeout)
+        timeout = due - now;
+    }
+    for (int i = 0; i < 2; i++)
+      if (fds[i].events == 0) // closed or queue full, POLLHUP would wake us up
+        fds[i].fd = -1;
+
+    // ppoll() to wait with microsecond precision, the delay is added per segment
+    struct timespec wait;
+    wait.tv_sec = timeout / 1000000;
+    wait.tv_nsec = timeout % 1000000 * 1000;
+    if (ppoll(fds, 2, timeout == -1 ? NULL : &wait, NULL) == -1 && errno != EINTR)
+      return ERECV;
+
+    for (int i = 0; i < 2; i++){
+      if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)) || !directions[i]->want_read())
+        continue;
+      ssize_t n = recv(directions[i]->from, buffer, sizeof buffer, 0);
+      if (n == -1 && (errno == EAGAIN || errno == EINTR))
+        continue;
+      if (n <= 0)
+        directions[i]->eof = true;
+      else
+        directions[i]->receive(buffer, n);
+    }
+
+    for (int i = 0; i < 2; i++){
+      int stat;
+      if ((stat = directions[i]->deliver()) != EOK)
+        return stat;
+    }
+  }
+  return EOK;
+}
+
+void sigcatcher(int n){
+  (void)n;
+  while (waitpid(-1, NULL, WNOHANG) > 0)
+    ;
+}
+
+/** Accepts connections, forks and relays each one to the target */
+int listen_and_relay(const Params &params){
+  int socketfd;
+  int flag = 1;
+  struct sockaddr_in addr;
+
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(atoi(params.port.c_str()));
+  if ((socketfd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+    return ECONNECTION;
+  setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof flag);
+  if (bind(socketfd, (struct sockaddr *)&addr, sizeof addr) == -1 ||
+      listen(socketfd, 10) == -1){
+    close(socketfd);
+    return ECONNECTION;
+  }
+
+  signal(SIGCHLD, sigcatcher);
+  while (1){
+    int clientfd;
+    if ((clientfd = accept(socketfd, NULL, NULL)) == -1)
+      continue;
+
+    int pid = fork(); // for each accepted connection create a child
+    if (pid < 0){
+      close(clientfd);
+      return EFORK;
+    }
+
+    if (pid == 0){ // child
+      close(socketfd);
+      srand(getpid()); // jitter differs among connections
+      int serverfd;
+      int stat = raceConnect(params.host, params.target_port, AF_UNSPEC, CONNECT_TIMEOUT, &serverfd);
+      if (stat != CONNECT_OK)
+        error_exit(stat == CONNECT_EHOST ? EHOST : ECONNECTION);
+
+      // every segment is sent on its own
+      setsockopt(clientfd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof flag);
+      setsockopt(serverfd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof flag);
+      fcntl(clientfd, F_SETFL, fcntl(clientfd, F_GETFL) | O_NONBLOCK);
+      fcntl(serverfd, F_SETFL, fcntl(serverfd, F_GETFL) | O_NONBLOCK);
+
+      stat = relay(params, clientfd, serverfd);
+      close(clientfd);
+      close(serverfd);
+      exit(stat);
+    }
+    close(clientfd); // parent doesn't need it
+  }
+
+  return EOK;
+}
+
+/** Datagram waiting for delivery */
+struct Datagram{
+  int fd; // socket to send from
+  struct sockaddr_storage to;
+  socklen_t to_size;
+  string data;
+};
+
+/** Client of the UDP transport and its socket towards the server */
+struct UdpSession{
+  int fd;
+  struct sockaddr_storage client;
+  socklen_t client_size;
+  struct sockaddr_storage server; // where the server answered from
+  socklen_t server_size; // 0 until the server answers
+  long long link_free[2]; // to server, to client
+  long long last; // last activity in us
+};
+
+/** Returns delivery time of a datagram of given size */
+long long schedule(const Params &params, size_t length, long long *link_free){
+  long long now = now_us();
+  long long start = *link_free > now ? *link_free : now;
+  *link_free = start + (params.bandwidth ? length * 1000000LL / params.bandwidth : 0);
+  return *link_free + params.delay + (params.jitter ? rand() % (params.jitter + 1) : 0);
+}
+
+/** Returns address as a string usable as a key */
+string address_key(const struct sockaddr_storage &addr, socklen_t size){
+  return string((const char *)&addr, size);
+}
+
+/**
+ * Relays UDP datagrams. Every client gets its own socket towards the
+ * server, so answers sent from the port of the transfer find their way
+ * back. Datagrams are delayed like TCP segments, but may be reordered.
+ */
+int relay_udp(const Params &params){
+  int listenfd;
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(atoi(params.port.c_str()));
+  if ((listenfd = socket(AF_INET, SOCK_DGRAM, 0)) == -1 ||
+      bind(listenfd, (struct sockaddr *)&addr, sizeof addr) == -1)
+    return ECONNECTION;
+
+  struct addrinfo setting;
+  struct addrinfo *target;
+  memset(&setting, 0, sizeof setting); // make the struct empty
+  setting.ai_family = AF_INET;
+  setting.ai_socktype = SOCK_DGRAM;
+  if (getaddrinfo(params.host.c_str(), params.target_port.c_str(), &setting, &target) != 0)
+    return EHOST;
+
+  map<string, UdpSession> sessions; // by client address
+  multimap<long long, Datagram> queue; // by delivery time
+  char buffer[BUFFSIZE];
+
+  while (1){
+    vector<struct pollfd> fds;
+    vector<UdpSession *> owners;
+    struct pollfd pfd = {listenfd, POLLIN, 0};
+    fds.push_back(pfd);
+    owners.push_back(NULL);
+    long long now = now_us();
+    for (map<string, UdpSession>::iterator i = sessions.begin(); i != sessions.end(); ){
+      if (now - i->second.last > UDP_SESSION * 1000000LL && queue.empty()){
+        close(i->second.fd);
+        sessions.erase(i++);
+        continue;
+      }
+      pfd.fd = i->second.fd;
+      fds.push_back(pfd);
+      owners.push_back(&i->second);
+      i++;
+    }
+
+    long long wait = queue.empty() ? 1000000 : queue.begin()->first - now;
+    if (wait < 0)
+      wait = 0;
+    struct timespec timeout = {(time_t)(wait / 1000000), (long)(wait % 1000000 * 1000)};
+    if (ppoll(&fds[0], fds.size(), &timeout, NULL) == -1 && errno != EINTR)
+      return ERECV;
+
+    for (size_t i = 0; i < fds.size(); i++){
+      if (!(fds[i].revents & POLLIN))
+        continue;
+      Datagram datagram;
+      struct sockaddr_storage from;
+      socklen_t from_size = sizeof from;
+      ssize_t length = recvfrom(fds[i].fd, buffer, sizeof buffer, 0, (struct sockaddr *)&from, &from_size);
+      if (length < 0)
+        continue;
+      datagram.data.assign(buffer, length);
+
+      UdpSession *session = owners[i];
+      long long due;
+      if (session == NULL){ // from a client
+        string key = address_key(from, from_size);
+        if (sessions.find(key) == sessions.end()){
+          UdpSession created;
+          if ((created.fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+            continue;
+          int rcvbuf = UDP_RCVBUF;
+          setsockopt(created.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+          created.client = from;
+          created.client_size = from_size;
+          created.server_size = 0;
+          created.link_free[0] = created.link_free[1] = 0;
+          sessions[key] = created;
+        }
+        session = &sessions[key];
+        datagram.fd = session->fd;
+        if (session->server_size){
+          datagram.to = session->server;
+          datagram.to_size = session->server_size;
+        }else{
+          memcpy(&datagram.to, target->ai_addr, target->ai_addrlen);
+          datagram.to_size = target->ai_addrlen;
+        }
+        due = schedule(params, length, &session->link_free[0]);
+      }else{ // from the server
+        session->server = from;
+        session->server_size = from_size;
+        datagram.fd = listenfd;
+        datagram.to = session->client;
+        datagram.to_size = session->client_size;
+        due = schedule(params, length, &session->link_free[1]);
+      }
+      session->last = now_us();
+      queue.insert(make_pair(due, datagram));
+    }
+
+    now = now_us();
+    while (!queue.empty() && queue.begin()->first <= now){
+      const Datagram &datagram = queue.begin()->second;
+      sendto(datagram.fd, datagram.data.data(), datagram.data.length(), 0,
+             (const struct sockaddr *)&datagram.to, datagram.to_size);
+      queue.erase(queue.begin());
+    }
+  }
+
+  return EOK;
+}
+
+//////// MAIN PROGRAM ////////
+int main (int argc, char *argv[]) {
+  Params params(argc, argv);
+  signal(SIGPIPE, SIG_IGN);
+  if (params.udp){
+    srand(getpid());
+    error_exit(relay_udp(params));
+  }
+  error_exit(listen_and_relay(params));
+  return EXIT_SUCCESS;
+}
@@ -23,8 +23,22 @@
 #include <sys/wait.h>
 #include <cstdio>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <ctime>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "udp.h"
+#include "control.h"
+#include "index.h"
+#include "adaptive.h"
+#include "trace.h"
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
 #define BUFFSIZE 1000
 
 using namespace std;
@@ -43,6 +57,8 @@ enum {
   EFILE,
   EREAD,
   EPROTOCOL,
+  ECONTROL,
+  EINDEX,
   EUNKNOWN // Unknown error
 };
 
@@ -60,6 +76,8 @@ const char *ECODEMSG[] = {
   "Requested file could not be opened",
   "Received message does not match the protocol",
   "Expecting different protocol code",
+  "Control socket could not be created",
+  "Served directory could not be indexed",
   "Unknown error"
 };
 
@@ -88,6 +106,11 @@ class Params{
     string port;
     //time for sending 1 packet = 1000B (~1kB) in microseconds
     unsigned long sending_time; 
+    unsigned long bandwidth; // kB/s
+    bool udp; // serve also the UDP transport on the same port
+    string control; // path of the control socket, empty - none
+    bool indexed; // requests are answered from index of the directory
+    string trace; // directory for traces of transfers, empty - none
   private:
     int get_positive_number(const string &str);
 };
@@ -116,61 +139,236 @@ int Params::get_positive_number(const string &str) {
  * @param argv Parameters
  */
 Params::Params(int argc, char *argv[]){
-  unsigned long bandwidth;
-  if (argc != 5) // -p "port" -d "bandwidth"
+  bandwidth = 0;
+  udp = false;
+  indexed = false;
+  if (argc < 5) // -p "port" -d "bandwidth" [-u] [-c "control socket"] [-i] [-t "trace dir"]
     error_exit(EPARAMNUM);
-  
-  if (strcmp(argv[1], "-p") == 0) {
-    port = argv[2];
-    if (get_positive_number(port) != 0 && strcmp(argv[3], "-d") == 0) {
-      if ((bandwidth = get_positive_number(argv[4])) != 0)
-        sending_time = 1000000.0 / bandwidth;
-        return;
+
+  for (int i = 1; i < argc; i++){
+    if (strcmp(argv[i], "-u") == 0)
+      udp = true;
+    else if (strcmp(argv[i], "-i") == 0)
+      indexed = true;
+    else if (i + 1 == argc) // option without value
+      error_exit(EPARAMNUM);
+    else if (strcmp(argv[i], "-p") == 0)
+      port = argv[++i];
+    else if (strcmp(argv[i], "-d") == 0)
+      bandwidth = get_positive_number(argv[++i]);
+    else if (strcmp(argv[i], "-c") == 0)
+      control = argv[++i];
+    else if (strcmp(argv[i], "-t") == 0)
+      trace = argv[++i];
+    else
+      error_exit(EPARAM);
+  }
+
+  if (get_positive_number(port) == 0 || bandwidth == 0 ||
+      (!trace.empty() && access(trace.c_str(), W_OK) == -1))
+    error_exit(EPARAM);
+  sending_time = 1000000.0 / bandwidth;
+}
+
+/** Transfers of the children, shared with them */
+static ControlTable *control_table = NULL;
+/** Set when a child finished and rates of the others can change */
+static volatile sig_atomic_t children_finished = 0;
+
+void sigcatcher(int n){
+  pid_t pid;
+  while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+    if (control_table != NULL && control_release(control_table, pid))
+      children_finished = 1;
+}
+
+/**
+ * Opens requested file. With the index, a file missing there is not
+ * looked up and a descriptor kept open by the index is used if there is one.
+ * @param owned Set if the descriptor is to be closed by close_requested()
+ */
+int open_requested(const FileIndex *index, const string &filename, int *filefd,
+                   off_t *file_len, bool *owned){
+  *owned = true;
+  if (index != NULL){
+    const IndexEntry *entry = index->lookup(filename);
+    if (entry == NULL)
+      return EFILE;
+    *file_len = entry->size;
+    if (entry->fd != -1){
+      *filefd = entry->fd;
+      *owned = false;
+      return EOK;
     }
-  }else if (strcmp(argv[1], "-d") == 0){
-    bandwidth = get_positive_number(argv[2]);
-    if (bandwidth != 0 && strcmp(argv[3], "-p") == 0) {
-      port = argv[4];
-      if (get_positive_number(port) != 0)
-        sending_time = 1000000.0 / bandwidth; 
-        return;
+    return (*filefd = open(filename.c_str(), O_RDONLY)) == -1 ? EFILE : EOK;
+  }
+
+  struct stat info;
+  if ((*filefd = open(filename.c_str(), O_RDONLY)) == -1)
+    return EFILE;
+  if (fstat(*filefd, &info) == -1){
+    close(*filefd);
+    return EREAD;
+  }
+  *file_len = info.st_size;
+  return EOK;
+}
+
+/** Closes file opened by open_requested() unless the index keeps it */
+void close_requested(int filefd, bool owned){
+  if (owned)
+    close(filefd);
+}
+
+/**
+ * Reads up to length bytes at the offset, a shorter count is returned
+ * only at the end of file
+ * @return Number of bytes read, -1 on error
+ */
+ssize_t read_at(int filefd, char *buffer, size_t length, off_t offset){
+  size_t total = 0;
+  ssize_t read;
+  while (total < length && (read = pread(filefd, buffer + total, length - total, offset + total)) != 0){
+    if (read == -1){
+      if (errno == EINTR)
+        continue;
+      return -1;
     }
+    total += read;
   }
-  error_exit(EPARAM);
+  return total;
 }
 
-void sigcatcher(int n){
-   wait3(NULL, WNOHANG, NULL);
+/** Returns monotonic time in microseconds */
+static long long now_us(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
 }
 
-/** Send file to a client.*/
-int send_file(int newfd, unsigned long sending_time){
+/** Sleeps until given monotonic time in microseconds */
+static void sleep_until(long long deadline){
+  struct timespec ts = {(time_t)(deadline / 1000000), (long)(deadline % 1000000 * 1000)};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+/**
+ * Returns length of the next frame for given rate and smoothed RTT
+ * @param rate Bytes per second, 0 - not limited
+ */
+static size_t frame_length(double rate, long long rtt_us){
+  if (rate == 0)
+    return ADAPT_MAX;
+  double length = MAX(rate * ADAPT_INTERVAL / 1E3, 2 * rate * rtt_us / 1E6);
+  return MIN(MAX(length, ADAPT_MIN), ADAPT_MAX);
+}
+
+/**
+ * Sends the file in frames of adaptive length (adaptive.h). Frames are sent
+ * at deadlines given by the rate, the time of waiting for acknowledgements
+ * is not added to them.
+ */
+int send_frames(int newfd, int filefd, off_t file_len, const ControlTable *table, TransferSlot *slot,
+                Tracer &trace){
+  vector<char> frame;
+  uint32_t seq = 0;
+  off_t offset = 0;
+  long long rtt = 0; // smoothed as in TCP, us
+  long long next_send = now_us();
+  bool last = false;
+
+  while (!last){
+    unsigned long sending_time = control_wait(table, slot); // us per 1000 B
+    double rate = sending_time ? 1E9 / sending_time : 0;
+    size_t length = MIN((off_t)frame_length(rate, rtt), file_len - offset);
+    last = offset + (off_t)length == file_len;
+
+    frame.resize(ADAPT_HEADER + length + 1);
+    snprintf(&frame[0], ADAPT_HEADER + 1, "%c%0*lu", last ? '7' : '8', ADAPT_LENLEN,
+             (unsigned long)length);
+    if (read_at(filefd, &frame[ADAPT_HEADER], length, offset) != (ssize_t)length)
+      return EREAD;
+    trace.add(TRACE_READ, seq, length);
+
+    long long now = now_us();
+    if (next_send < now - ADAPT_INTERVAL * 1000LL) // late (paused, slow client), no catching up
+      next_send = now;
+    sleep_until(next_send);
+    trace.add(TRACE_PACED, seq, length);
+    long long sent_at = now_us();
+    if (send(newfd, &frame[0], ADAPT_HEADER + length, 0) != (ssize_t)(ADAPT_HEADER + length))
+      return ESEND;
+    trace.add(TRACE_SENT, seq, length);
+    control_sent(slot, length);
+    offset += length;
+    next_send += (long long)(length * sending_time / 1000);
+
+    char ack;
+    ssize_t received;
+    while ((received = recv(newfd, &ack, 1, 0)) == -1 && errno == EINTR)
+      ;
+    if (received != 1)
+      return ERECV;
+    trace.add(TRACE_ACKED, seq++, length);
+    long long sample = now_us() - sent_at;
+    rtt = rtt ? (7 * rtt + sample) / 8 : sample;
+    if (ack != (last ? '2' : '1'))
+      return EPROTOCOL;
+  }
+  return EOK;
+}
+
+/**
+ * Send file to a client.
+ * Sending time of each block and the pause flag are taken from the slot.
+ * Request ending by ADAPT_REQUEST is served by send_frames().
+ */
+int send_file(int newfd, const ControlTable *table, TransferSlot *slot, const FileIndex *index,
+              Tracer &trace){
 
   char buffer[BUFFSIZE + 1];
 
   string recv_msg = "";
-  while (recv_msg.length() < 2 ||
-          strcmp(recv_msg.substr(recv_msg.length() - 2).c_str(), ";\n")){
+  while (recv_msg.empty() || recv_msg[recv_msg.length() - 1] != '\n'){
     memset(&buffer, 0, sizeof(buffer)); // make the buffer empty
-    if (recv(newfd, buffer, BUFFSIZE, 0) == -1)
+    if (recv(newfd, buffer, BUFFSIZE, 0) <= 0)
       return ERECV;
     recv_msg += buffer;
   } 
+
+  bool adaptive = recv_msg.length() > strlen(ADAPT_REQUEST) &&
+                  recv_msg.compare(recv_msg.length() - strlen(ADAPT_REQUEST), string::npos,
+                                   ADAPT_REQUEST) == 0;
+  size_t end_length = adaptive ? strlen(ADAPT_REQUEST) : 2;
+  if (!adaptive && (recv_msg.length() < 2 || recv_msg.compare(recv_msg.length() - 2, 2, ";\n")))
+    return EPROTOCOL;
   
-  FILE * file;
-  if ((file = fopen(recv_msg.substr(0, recv_msg.length() - 2).c_str(), "rb")) == NULL){
+  int filefd;
+  off_t file_len;
+  bool owned;
+  string filename = recv_msg.substr(0, recv_msg.length() - end_length);
+  int stat;
+  if ((stat = open_requested(index, filename, &filefd, &file_len, &owned)) != EOK){
     // Could not open requested file
     string send_msg = "9"; 
     if (send(newfd, send_msg.c_str(), send_msg.length(), 0) == -1){
       return ESEND;
     }
-    return EFILE;
+    return stat;
+
+  }else if (adaptive){
+    control_file(slot, filename, file_len);
+    trace.add(TRACE_REQUEST, 0, file_len);
+    stat = send_frames(newfd, filefd, file_len, table, slot, trace);
+    close_requested(filefd, owned);
+    return stat;
 
   }else{
-    fseek(file, 0, SEEK_END);
-    long file_len = ftell(file);
-    rewind(file);
-    long read_total = 0;
+    control_file(slot, filename, file_len);
+    trace.add(TRACE_REQUEST, 0, file_len);
+    uint32_t seq = 0;
+    off_t read_total = 0;
     int read = 0;
     char file_buffer[BUFFSIZE+1];
     bool last = false;
@@ -183,11 +381,13 @@ int send_file(int newfd, unsigned long sending_time){
     struct timeval tp;
     bool time_set = false;
     int usleep_for;
+    unsigned long sending_time;
     while (!last){
       memset(&file_buffer, 0, sizeof(file_buffer)); // make the send buffer empty
 
-      read = fread(file_buffer, sizeof(char), BUFFSIZE - 1, file);
+      read = read_at(filefd, file_buffer, MIN(BUFFSIZE - 1, file_len - read_total), read_total);
       read_total += read;
+      trace.add(TRACE_READ, seq, read);
       if (read_total == file_len && read < BUFFSIZE - 4){ // last packet
       //Last packet contains 4 additional characters at the beginning.
       //!! must be changed if BUFFSIZE is different from 1000
@@ -210,14 +410,15 @@ int send_file(int newfd, unsigned long sending_time){
       }else if (read == BUFFSIZE - 1){ // regular packet, is not last
         send_msg = "8";
       }else{
-        fclose(file);
+        close_requested(filefd, owned);
         return EREAD;
       }
       string a (file_buffer, read);
 
       send_msg += a;
       
-      // Setting bandwidth
+      // Setting bandwidth, it can be changed or paused through control socket
+      sending_time = control_wait(table, slot);
       if (time_set){
         gettimeofday(&tp, NULL);
         sec = static_cast<double>(tp.tv_sec);
@@ -231,34 +432,309 @@ int send_file(int newfd, unsigned long sending_time){
       usec = static_cast<double>(tp.tv_usec)/1E6;
       start = sec + usec;
       time_set = true;
+      trace.add(TRACE_PACED, seq, read);
 
       if (send(newfd, send_msg.c_str(), send_msg.length(), 0) == -1){
-        fclose(file);
+        close_requested(filefd, owned);
         return ESEND;
       }
+      trace.add(TRACE_SENT, seq, read);
+      control_sent(slot, read);
       recv_msg = "";
       memset(&buffer, 0, sizeof(buffer)); // make the receive buffer empty
       if (recv(newfd, buffer, BUFFSIZE, 0) == -1){
-        fclose(file);
+        close_requested(filefd, owned);
         return ERECV;
       }
+      trace.add(TRACE_ACKED, seq++, read);
       recv_msg += buffer;
       if (last){
         if (strcmp(recv_msg.substr().c_str(), "2")){
         // client has not received all the file
-          fclose(file);
+          close_requested(filefd, owned);
           return EPROTOCOL;
         }
         break;
       }
       if (strcmp(recv_msg.substr().c_str(), "1")){
         // expecting 1, but code is different
-        fclose(file);
+        close_requested(filefd, owned);
         return EPROTOCOL;
       }
     }
   }
-  fclose(file);
+  close_requested(filefd, owned);
+  return EOK;
+}
+
+#define UDP_BLOCK (UDP_HEADER + UDP_PAYLOAD + 1) // datagram of a block with '\0' of the header
+
+/**
+ * Reads one block of the file into its datagram
+ * @return Length of the datagram, -1 if the block could not be read
+ */
+ssize_t read_block(int filefd, unsigned long seq, off_t file_len, char *datagram){
+  off_t offset = (off_t)seq * UDP_PAYLOAD;
+  size_t length = MIN(UDP_PAYLOAD, file_len - offset);
+
+  snprintf(datagram, UDP_BLOCK, "8%0*lu", UDP_SEQLEN, seq);
+  if (pread(filefd, datagram + UDP_HEADER, length, offset) != (ssize_t)length)
+    return -1;
+  return UDP_HEADER + length;
+}
+
+/** Sends datagram of a block through UDP socket */
+int send_datagram(int sockfd, const char *datagram, size_t length){
+  if (send(sockfd, datagram, length, 0) == -1 &&
+      errno != ENOBUFS && errno != EAGAIN) // these are the same as loss
+    return ESEND;
+  return EOK;
+}
+
+/** Sends one block of the file through UDP socket */
+int send_block(int sockfd, int filefd, unsigned long seq, off_t file_len){
+  char datagram[UDP_BLOCK];
+  ssize_t length = read_block(filefd, seq, file_len, datagram);
+  if (length == -1)
+    return EREAD;
+  return send_datagram(sockfd, datagram, length);
+}
+
+/**
+ * Processes datagram from the client during UDP transfer
+ * @param retransmit Blocks reported missing are added here
+ * @param done Set if the client received whole file
+ */
+void handle_udp_message(const char *msg, size_t length, unsigned long blocks,
+                        set<unsigned long> &retransmit, bool *done, Tracer &trace){
+  if (length == 0)
+    return;
+  if (msg[0] == '2'){
+    trace.add(TRACE_ACKED, blocks, 0);
+    *done = true;
+  }else if (msg[0] == 'N'){ // N<a>-<b>,<c>-<d>...
+    size_t missing = retransmit.size();
+    istringstream ranges(string(msg + 1, length - 1));
+    string range;
+    while (getline(ranges, range, ',')){
+      unsigned long first, last;
+      if (sscanf(range.c_str(), "%lu-%lu", &first, &last) != 2)
+        continue;
+      for (; first <= last && first < blocks; first++)
+        retransmit.insert(first);
+    }
+    trace.add(TRACE_NACK, 0, retransmit.size() - missing);
+  }
+}
+
+/**
+ * Sends file to a client over UDP. Blocks are paced by the sending time
+ * of the slot, missing blocks reported by the client are sent before new
+ * ones. A paused transfer keeps the client waiting by repeating the start.
+ * @param sockfd UDP socket connected to the client
+ */
+int send_file_udp(int sockfd, const string &filename, const ControlTable *table, TransferSlot *slot,
+                  const FileIndex *index, Tracer &trace){
+  int filefd;
+  off_t file_len;
+  bool owned;
+  int stat;
+  if ((stat = open_requested(index, filename, &filefd, &file_len, &owned)) != EOK){
+    for (int i = 0; i < 3; i++) // there is no retransmission of this one
+      send(sockfd, "9", 1, 0);
+    return stat;
+  }
+
+  control_file(slot, filename, file_len);
+  trace.add(TRACE_REQUEST, 0, file_len);
+  unsigned long blocks = (file_len + UDP_PAYLOAD - 1) / UDP_PAYLOAD;
+  ostringstream convert;
+  convert << "5" << file_len;
+  string start_msg = convert.str();
+
+  char msg[UDP_DATAGRAM];
+  ssize_t length = -1;
+  long long now = now_us();
+  long long deadline = now + UDP_TIMEOUT * 1000LL;
+  while (length <= 0){ // start, repeated until the client answers
+    if (now_us() > deadline || send(sockfd, start_msg.c_str(), start_msg.length(), 0) == -1){
+      close_requested(filefd, owned);
+      return ERECV;
+    }
+    struct pollfd pfd = {sockfd, POLLIN, 0};
+    if (poll(&pfd, 1, UDP_RETRY) == 1 && (length = recv(sockfd, msg, sizeof msg, 0)) == -1 &&
+        errno == ECONNREFUSED){
+      close_requested(filefd, owned);
+      return ERECV;
+    }
+  }
+
+  set<unsigned long> retransmit;
+  unsigned long next_new = 0;
+  char datagram[UDP_BLOCK]; // next block, read before it is paced
+  ssize_t prepared = 0; // length of the datagram, 0 - no block read
+  unsigned long prepared_seq = 0;
+  bool prepared_again = false; // the block is retransmitted
+  bool done = false;
+  stat = EOK;
+  now = now_us();
+  long long next_send = now;
+  long long last_heard = now;
+  long long last_sent = now;
+  handle_udp_message(msg, length, blocks, retransmit, &done, trace);
+
+  while (!done && stat == EOK){
+    now = now_us();
+    bool paused;
+    unsigned long sending_time = control_pacing(table, slot, &paused);
+    if (!paused && prepared == 0 && (next_new < blocks || !retransmit.empty())){
+      prepared_seq = next_new;
+      prepared_again = !retransmit.empty();
+      if (prepared_again){
+        prepared_seq = *retransmit.begin();
+        retransmit.erase(retransmit.begin());
+      }else{
+        next_new++;
+      }
+      if ((prepared = read_block(filefd, prepared_seq, file_len, datagram)) == -1){
+        stat = EREAD;
+        break;
+      }
+      trace.add(TRACE_READ, prepared_seq, prepared - UDP_HEADER);
+    }
+    bool work = !paused && prepared != 0;
+    long long wait = work ? next_send - now : last_sent + UDP_RETRY * 1000LL - now;
+    if (paused && wait > CONTROL_PAUSE * 1000LL)
+      wait = CONTROL_PAUSE * 1000LL;
+    if (wait < 0)
+      wait = 0;
+    struct pollfd pfd = {sockfd, POLLIN, 0};
+    struct timespec timeout = {(time_t)(wait / 1000000), (long)(wait % 1000000 * 1000)};
+    if (ppoll(&pfd, 1, &timeout, NULL) == 1){
+      if ((length = recv(sockfd, msg, sizeof msg, 0)) == -1 && errno == ECONNREFUSED){
+        stat = ERECV; // client is gone
+      }else if (length > 0){
+        last_heard = now_us();
+        handle_udp_message(msg, length, blocks, retransmit, &done, trace);
+      }
+      continue;
+    }
+
+    now = now_us();
+    if (now - last_heard > UDP_TIMEOUT * 1000LL){
+      stat = ERECV;
+    }else if (work && now >= next_send){
+      size_t bytes = prepared - UDP_HEADER;
+      trace.add(TRACE_PACED, prepared_seq, bytes);
+      stat = send_datagram(sockfd, datagram, prepared);
+      trace.add(prepared_again ? TRACE_RETRANSMIT : TRACE_SENT, prepared_seq, bytes);
+      prepared = 0;
+      control_sent(slot, bytes);
+      next_send += sending_time; // deadline, time spent sending is not added
+      if (next_send < now)
+        next_send = now;
+      last_sent = now;
+    }else if (!work && now - last_sent >= UDP_RETRY * 1000LL){
+      // nothing to send, client may have missed the tail or we missed "2",
+      // a paused transfer only keeps the client waiting
+      if (paused || blocks == 0){
+        send(sockfd, start_msg.c_str(), start_msg.length(), 0);
+      }else{
+        stat = send_block(sockfd, filefd, blocks - 1, file_len);
+        trace.add(TRACE_RETRANSMIT, blocks - 1, file_len - (off_t)(blocks - 1) * UDP_PAYLOAD);
+      }
+      last_sent = now;
+    }
+  }
+
+  close_requested(filefd, owned);
+  return stat;
+}
+
+/**
+ * Forks a child serving one transfer of the client. Its slot in the table
+ * is assigned before SIGCHLD of the child can be handled.
+ * @param slot Slot of the transfer is returned here, NULL if table is full
+ * @return Value returned by fork()
+ */
+static pid_t fork_transfer(ControlTable *table, const string &client, TransferSlot **slot){
+  sigset_t chld, old;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, &old);
+  *slot = control_reserve(table, client);
+  pid_t pid = fork();
+  if (pid != 0)
+    control_started(table, *slot, pid);
+  sigprocmask(SIG_SETMASK, &old, NULL);
+  return pid;
+}
+
+/**
+ * Receives request on the UDP socket and forks a child serving it from
+ * its own socket. Repeated requests of a client are ignored for a while.
+ * With the index, a missing file is answered here and the file is opened
+ * before fork to be kept open by the index.
+ * @param recent Recently served requests and their time
+ */
+int accept_udp(int socketfd, int udpfd, ControlSocket &control, ControlTable *table,
+               FileIndex *index, const string &trace_dir, map<string, long long> &recent){
+  char msg[UDP_DATAGRAM];
+  struct sockaddr_storage cl_addr;
+  socklen_t cl_addr_size = sizeof(cl_addr);
+  ssize_t length = recvfrom(udpfd, msg, sizeof msg, 0, (struct sockaddr*)&cl_addr, &cl_addr_size);
+  if (length < 3 || msg[length - 2] != ';' || msg[length - 1] != '\n')
+    return EOK; // not a request
+
+  string filename(msg, length - 2);
+  if (index != NULL && index->lookup(filename) == NULL){
+    sendto(udpfd, "9", 1, 0, (struct sockaddr*)&cl_addr, cl_addr_size);
+    return EOK;
+  }
+  char host[NI_MAXHOST];
+  char port[NI_MAXSERV];
+  if (getnameinfo((struct sockaddr*)&cl_addr, cl_addr_size, host, sizeof host, port, sizeof port,
+                  NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+    return EOK;
+  string key = string(host) + ":" + port + "/" + filename;
+
+  long long now = now_us();
+  map<string, long long>::iterator i = recent.begin();
+  while (i != recent.end()){
+    if (now - i->second > UDP_DEDUP * 1000LL)
+      recent.erase(i++);
+    else
+      i++;
+  }
+  if (recent.count(key))
+    return EOK; // repeated request
+  recent[key] = now;
+  if (index != NULL)
+    index->open_file(filename);
+
+  TransferSlot *slot;
+  int pid = fork_transfer(table, host, &slot); // for each request create a child
+  if (pid < 0)
+    return EFORK;
+
+  if (pid == 0){ // child
+    close(socketfd);
+    close(udpfd);
+    control.close();
+    int sockfd;
+    if ((sockfd = socket(cl_addr.ss_family, SOCK_DGRAM, 0)) == -1 ||
+        connect(sockfd, (struct sockaddr*)&cl_addr, cl_addr_size) == -1)
+      error_exit(ECONNECTION);
+    Tracer trace;
+    if (!trace_dir.empty())
+      trace.open(trace_dir);
+    int stat = send_file_udp(sockfd, filename, table, slot, index, trace);
+    trace.add(TRACE_END, 0, stat);
+    trace.close();
+    close(sockfd);
+    error_exit(stat);
+    exit(EXIT_SUCCESS);
+  }
   return EOK;
 }
 
@@ -279,6 +755,8 @@ int connect(Params params){
     if ((socketfd = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol)) == -1)
       continue;
 
+    int flag = 1; // port can be reused right after restart
+    setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof flag);
     if (bind(socketfd, ptr->ai_addr, ptr->ai_addrlen) == -1){
       close(socketfd);
       continue;
@@ -298,17 +776,87 @@ int connect(Params params){
     return ECONNECTION;
   }
 
+  int udpfd = -1;
+  if (params.udp){
+    setting.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(NULL, params.port.c_str(), &setting, &list) != 0)
+      return EHOST;
+    if ((udpfd = socket(list->ai_family, list->ai_socktype, list->ai_protocol)) == -1 ||
+        bind(udpfd, list->ai_addr, list->ai_addrlen) == -1){
+      freeaddrinfo(list);
+      close(socketfd);
+      return ECONNECTION;
+    }
+    freeaddrinfo(list);
+  }
+
+  ControlTable *table;
+  ControlSocket control;
+  if ((table = control_create(params.bandwidth)) == NULL ||
+      (!params.control.empty() && !control.open(params.control))){
+    close(socketfd);
+    return ECONTROL;
+  }
+  FileIndex files;
+  FileIndex *index = NULL;
+  if (params.indexed){
+    if (!files.build()){
+      close(socketfd);
+      return EINDEX;
+    }
+    index = &files;
+  }
+
   int newfd;
   struct sockaddr_storage cl_addr;
   socklen_t cl_addr_size;
+  map<string, long long> recent; // UDP requests being served
+  control_table = table;
   signal(SIGCHLD, sigcatcher);
   while (1){
+    // wait for TCP connection, UDP request or control command
+    vector<struct pollfd> fds;
+    struct pollfd pfd = {socketfd, POLLIN, 0};
+    fds.push_back(pfd);
+    if (udpfd != -1){
+      pfd.fd = udpfd;
+      fds.push_back(pfd);
+    }
+    if (index != NULL){
+      pfd.fd = index->fd();
+      fds.push_back(pfd);
+    }
+    control.add_fds(fds);
+    int ready = poll(&fds[0], fds.size(), -1);
+    if (children_finished){ // share of rates of the others can change
+      children_finished = 0;
+      control_update(table);
+      vector<string> requested; // kept open by the index for next requests
+      control_collect(table, requested);
+      for (size_t i = 0; index != NULL && i < requested.size(); i++)
+        index->open_file(requested[i]);
+    }
+    if (ready <= 0)
+      continue;
+    control.handle(fds, table);
+    if (index != NULL && (fds[udpfd != -1 ? 2 : 1].revents & POLLIN))
+      index->handle_events();
+    int stat;
+    if (udpfd != -1 && (fds[1].revents & POLLIN) &&
+        (stat = accept_udp(socketfd, udpfd, control, table, index, params.trace, recent)) != EOK)
+      return stat;
+    if (!(fds[0].revents & POLLIN))
+      continue;
+
     cl_addr_size = sizeof(cl_addr);
     if ((newfd = accept(socketfd, (struct sockaddr*)&cl_addr, &cl_addr_size)) == -1){
       continue; 
     }
 
-    int pid = fork(); // for each accepted connection create a child
+    char host[NI_MAXHOST] = "";
+    getnameinfo((struct sockaddr*)&cl_addr, cl_addr_size, host, sizeof host, NULL, 0, NI_NUMERICHOST);
+    TransferSlot *slot;
+    int pid = fork_transfer(table, host, &slot); // for each accepted connection create a child
     if (pid < 0){
       close(newfd);
       //kill(0, SIGTERM);
@@ -317,15 +865,19 @@ int connect(Params params){
 
     if (pid == 0){ // child
       close(socketfd); // no need to have for a child
-
-      int stat;
-      if ((stat = send_file(newfd, params.sending_time)) != EOK){
-        close(newfd);
-        return stat;
-      }else{
-        close(newfd);
-        exit(EXIT_SUCCESS);
-      }
+      if (udpfd != -1)
+        close(udpfd);
+      control.close();
+
+      Tracer trace;
+      if (!params.trace.empty())
+        trace.open(params.trace);
+      stat = send_file(newfd, table, slot, index, trace);
+      trace.add(TRACE_END, 0, stat);
+      trace.close();
+      close(newfd);
+      error_exit(stat); // not returned, the index of the parent is not to be destroyed
+      exit(EXIT_SUCCESS);
 
     } else{
       close(newfd); // parent doesn't need it
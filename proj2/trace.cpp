@@ -0,0 +1,61 @@
+/**
+  * File:    trace.cpp
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Binary trace of transfers sent by the server (server -t dir).
+  *          IPP project 2, FIT VUTBR
+  */
+
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "trace.h"
+
+using namespace std;
+
+/**
+ * Creates dir/trace-<pid>.bin and allocates the ring
+ * @return false if the file could not be created
+ */
+bool Tracer::open(const string &dir){
+  ostringstream path;
+  path << dir << "/trace-" << getpid() << ".bin";
+  if ((fd = ::open(path.str().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+    return false;
+
+  TraceHeader header;
+  memcpy(header.magic, TRACE_MAGIC, sizeof header.magic);
+  header.version = TRACE_VERSION;
+  header.record_size = sizeof(TraceRecord);
+  if (write(fd, &header, sizeof header) != sizeof header){
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+  ring = new TraceRecord[TRACE_RING];
+  length = 0;
+  return true;
+}
+
+/** Writes records from the ring, tracing stops if the file cannot be written */
+void Tracer::flush(){
+  size_t size = length * sizeof(TraceRecord);
+  length = 0;
+  if (write(fd, ring, size) != (ssize_t)size)
+    close();
+}
+
+/** Writes the rest of records and closes the file */
+void Tracer::close(){
+  if (ring == NULL)
+    return;
+  if (length)
+    flush();
+  if (fd != -1)
+    ::close(fd);
+  fd = -1;
+  delete[] ring;
+  ring = NULL;
+}
@@ -0,0 +1,80 @@
+/**
+  * File:    trace.h
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Binary trace of transfers sent by the server (server -t dir),
+  *          read by traceview.
+  *          IPP project 2, FIT VUTBR
+  *
+  * Every child serving a transfer writes dir/trace-<pid>.bin: TraceHeader
+  * followed by TraceRecord for each event, in the byte order of the server.
+  * Records are collected in a preallocated ring of TRACE_RING records and
+  * written when it is full and when the transfer ends.
+  */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <stdint.h>
+#include <ctime>
+
+#define TRACE_MAGIC "IPKTRACE"
+#define TRACE_VERSION 1
+#define TRACE_RING 4096 // records kept before writing
+
+/** Events of the transfer */
+enum {
+  TRACE_REQUEST = 1, // file opened, bytes - its length
+  TRACE_READ, // block read from the file
+  TRACE_PACED, // waiting for the sending time is over
+  TRACE_SENT, // block sent
+  TRACE_RETRANSMIT, // block sent again (UDP)
+  TRACE_ACKED, // block acknowledged, the whole file for UDP
+  TRACE_NACK, // NACK received (UDP), bytes - number of missing blocks
+  TRACE_END // transfer finished, bytes - error code
+};
+
+/** Beginning of the trace file */
+struct TraceHeader {
+  char magic[8]; // TRACE_MAGIC without '\0'
+  uint32_t version;
+  uint32_t record_size; // sizeof(TraceRecord)
+};
+
+/** One event */
+struct TraceRecord {
+  uint64_t time; // monotonic, ns
+  uint64_t bytes; // payload bytes of the block
+  uint32_t seq; // number of the block
+  uint32_t type;
+};
+
+/** Writer of the trace of one transfer, does nothing unless opened */
+class Tracer {
+  public:
+    Tracer() : fd(-1), ring(NULL), length(0) {}
+    ~Tracer() { close(); }
+    bool open(const std::string &dir);
+    void close();
+    /** Records event with the current time */
+    void add(uint32_t type, uint32_t seq, uint64_t bytes){
+      if (ring == NULL)
+        return;
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      TraceRecord &record = ring[length++];
+      record.time = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+      record.bytes = bytes;
+      record.seq = seq;
+      record.type = type;
+      if (length == TRACE_RING)
+        flush();
+    }
+  private:
+    void flush();
+    int fd;
+    TraceRecord *ring;
+    unsigned length;
+};
+
+#endif
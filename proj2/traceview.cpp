@@ -0,0 +1,207 @@
+/**
+  * File:    traceview.cpp
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: Analyzer of traces written by server -t (trace.h): sent rate
+  *          over time, jitter of sending and round trip of acknowledgements.
+  *          IPP project 2, FIT VUTBR
+  *          Usage: traceview [-i interval_ms] trace.bin...
+  */
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+
+#include "trace.h"
+
+using namespace std;
+
+/** Error values */
+enum {
+  EOK = 0, // No error detected
+  EPARAM, // Wrong parameter
+  EFILE, // Trace could not be read
+  EUNKNOWN // Unknown error
+};
+
+/** Error messages */
+const char *ECODEMSG[] = {
+  "Everything is OK.",
+  "Usage: traceview [-i interval_ms] trace.bin...",
+  "Trace could not be read",
+  "Unknown error"
+};
+
+/**
+ * Prints error messages according to given error code and exits;
+ * @param ecode Error code
+ */
+void error_exit(int eCode){
+  if (eCode == EOK)
+    return;
+
+  if (eCode < EOK || eCode > EUNKNOWN)
+    eCode = EUNKNOWN;
+
+  cerr << ECODEMSG[eCode] << endl;
+  exit(eCode);
+}
+
+/** Durations in microseconds */
+class Samples {
+  public:
+    void add(double us) { values.push_back(us); }
+    size_t size() const { return values.size(); }
+    void print(const string &name);
+  private:
+    vector<double> values;
+};
+
+/** Prints min, median, 99th percentile, max, mean and standard deviation */
+void Samples::print(const string &name){
+  cout << "  " << name << ": ";
+  if (values.empty()){
+    cout << "none" << endl;
+    return;
+  }
+  sort(values.begin(), values.end());
+  double sum = 0, squares = 0;
+  for (size_t i = 0; i < values.size(); i++)
+    sum += values[i];
+  double mean = sum / values.size();
+  for (size_t i = 0; i < values.size(); i++)
+    squares += (values[i] - mean) * (values[i] - mean);
+  cout << fixed << setprecision(0) << "min " << values[0]
+       << " us, median " << values[values.size() / 2]
+       << " us, p99 " << values[values.size() * 99 / 100]
+       << " us, max " << values.back()
+       << " us, mean " << mean
+       << " us, stddev " << sqrt(squares / values.size()) << " us" << endl;
+}
+
+/** Reads records of the trace, checks its header */
+int read_trace(const string &path, vector<TraceRecord> &records){
+  ifstream file(path.c_str(), ios::binary);
+  TraceHeader header;
+  if (!file.read((char *)&header, sizeof header) ||
+      memcmp(header.magic, TRACE_MAGIC, sizeof header.magic) != 0 ||
+      header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord))
+    return EFILE;
+  TraceRecord record;
+  while (file.read((char *)&record, sizeof record))
+    records.push_back(record);
+  return EOK;
+}
+
+/** Prints report of one trace */
+int report(const string &path, long long interval_us){
+  vector<TraceRecord> records;
+  if (read_trace(path, records) != EOK || records.empty())
+    return EFILE;
+
+  uint64_t start = records[0].time;
+  uint64_t end = records.back().time;
+  unsigned long blocks = 0, retransmitted = 0, nacks = 0, missing = 0;
+  unsigned long long bytes = 0, file_len = 0;
+  long long status = -1;
+  Samples gaps, waits, rtts;
+  double jitter = 0; // RFC 3550, smoothed difference of consecutive gaps
+  uint64_t last_sent = 0;
+  double last_gap = -1;
+  map<uint32_t, uint64_t> read_at, sent_at; // by block
+  vector<unsigned long long> rate; // bytes sent in each interval
+
+  for (size_t i = 0; i < records.size(); i++){
+    const TraceRecord &r = records[i];
+    switch (r.type){
+      case TRACE_REQUEST:
+        file_len = r.bytes;
+        break;
+      case TRACE_READ:
+        read_at[r.seq] = r.time;
+        break;
+      case TRACE_PACED:
+        if (read_at.count(r.seq))
+          waits.add((r.time - read_at[r.seq]) / 1E3);
+        break;
+      case TRACE_SENT:
+      case TRACE_RETRANSMIT:{
+        if (r.type == TRACE_SENT)
+          blocks++;
+        else
+          retransmitted++;
+        bytes += r.bytes;
+        sent_at[r.seq] = r.time;
+        size_t slot = (r.time - start) / 1000 / interval_us;
+        if (rate.size() <= slot)
+          rate.resize(slot + 1, 0);
+        rate[slot] += r.bytes;
+        if (last_sent){
+          double gap = (r.time - last_sent) / 1E3;
+          gaps.add(gap);
+          if (last_gap >= 0)
+            jitter += (fabs(gap - last_gap) - jitter) / 16;
+          last_gap = gap;
+        }
+        last_sent = r.time;
+        break;
+      }
+      case TRACE_ACKED:
+        if (sent_at.count(r.seq))
+          rtts.add((r.time - sent_at[r.seq]) / 1E3);
+        break;
+      case TRACE_NACK:
+        nacks++;
+        missing += r.bytes;
+        break;
+      case TRACE_END:
+        status = r.bytes;
+        break;
+    }
+  }
+
+  double seconds = (end - start) / 1E9;
+  cout << path << ": file " << file_len << " B, " << blocks << " blocks, " << bytes
+       << " B sent in " << fixed << setprecision(3) << seconds * 1E3 << " ms ("
+       << setprecision(1) << (seconds > 0 ? bytes / seconds / 1E3 : 0) << " kB/s), "
+       << retransmitted << " retransmitted, " << nacks << " NACKs of " << missing
+       << " blocks, status " << status << endl;
+  gaps.print("send interval");
+  cout << "  send jitter: " << setprecision(0) << jitter << " us" << endl;
+  waits.print("read to send");
+  if (rtts.size())
+    rtts.print("ack round trip");
+  cout << "  rate over time (ms, kB/s):" << endl;
+  for (size_t i = 0; i < rate.size(); i++)
+    cout << "    " << setprecision(0) << i * interval_us / 1E3 << " " << setprecision(1)
+         << rate[i] / (interval_us / 1E6) / 1E3 << endl;
+  return EOK;
+}
+
+//////// MAIN PROGRAM ////////
+int main(int argc, char *argv[]){
+  long long interval_us = 100000;
+  int first = 1;
+  if (argc > 2 && strcmp(argv[1], "-i") == 0){
+    interval_us = atoll(argv[2]) * 1000;
+    first = 3;
+  }
+  if (first >= argc || interval_us <= 0)
+    error_exit(EPARAM);
+
+  int stat = EOK;
+  for (int i = first; i < argc; i++){
+    if (report(argv[i], interval_us) != EOK){
+      cerr << argv[i] << ": " << ECODEMSG[EFILE] << endl;
+      stat = EFILE;
+    }
+  }
+  error_exit(stat);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,34 @@
+/**
+  * File:    udp.h
+  * Author:  Martin Borek, xborek08@stud.fit.vutbr.cz
+  * Project: UDP transport of the file server (server -u, client -u).
+  *          IPP project 2, FIT VUTBR
+  *
+  * Every datagram starts with a type character:
+  *   client -> server port  "filename;\n"     request, repeated until answered
+  *   server -> client       "9"                file could not be opened
+  *   server -> client       "5<size>"          start, sent from the port of the
+  *                                             transfer, repeated until answered
+  *   client -> server       "1"                start received, send the blocks
+  *   server -> client       "8<seq><data>"     block seq (UDP_SEQLEN digits) with
+  *                                             UDP_PAYLOAD bytes, the last one shorter
+  *   client -> server       "N<a>-<b>,<c>-<d>" blocks a..b and c..d are missing
+  *   client -> server       "2"                whole file received
+  * Blocks are paced by the bandwidth of the server, missing ones are
+  * retransmitted before new ones.
+  */
+
+#ifndef UDP_H
+#define UDP_H
+
+#define UDP_PAYLOAD 999 // file bytes in one block, as in TCP mode
+#define UDP_SEQLEN 10 // digits of the sequence number
+#define UDP_HEADER (1 + UDP_SEQLEN)
+#define UDP_DATAGRAM 1472 // largest datagram sent or received
+#define UDP_RETRY 200 // ms between repeated requests, starts and probes
+#define UDP_TIMEOUT 10000 // ms of silence after which the transfer fails
+#define UDP_NACKMIN 20 // ms, minimal interval between NACKs of one block
+#define UDP_DEDUP 10000 // ms for which repeated requests are ignored
+#define UDP_RCVBUF (1 << 20) // receive buffer of the data sockets, bytes
+
+#endif